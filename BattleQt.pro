@@ -2,15 +2,64 @@ TEMPLATE = lib
 
 QT += network
 
+LIBS += -lz
+win32: LIBS += -ladvapi32
+
+# qmake CONFIG+=notrace compiles the trace points out
+notrace: DEFINES += BATTLEQT_NO_TRACE
+
 HEADERS += \
     src/include/connectionmanager.h \
+    src/include/networkstatistics.h \
     src/connectionmanager_p.h \
     src/server.h \
-    src/client.h
+    src/serversession.h \
+    src/serverlistener.h \
+    src/serverworker.h \
+    src/client.h \
+    src/framedecoder.h \
+    src/protocol.h \
+    src/framewriter.h \
+    src/fragmentassembler.h \
+    src/connectionoptions.h \
+    src/latencytracker.h \
+    src/networkclock.h \
+    src/clockestimator.h \
+    src/unreliablechannel.h \
+    src/statetable.h \
+    src/snapshothistory.h \
+    src/lockstep.h \
+    src/payloadcompressor.h \
+    src/trace.h \
+    src/serverbeacon.h \
+    src/serverdiscovery.h \
+    src/resumeregistry.h \
+    src/nameregistry.h
 
 SOURCES += src/connectionmanager.cpp \
     src/server.cpp \
-    src/client.cpp
+    src/serversession.cpp \
+    src/serverlistener.cpp \
+    src/serverworker.cpp \
+    src/client.cpp \
+    src/framedecoder.cpp \
+    src/protocol.cpp \
+    src/framewriter.cpp \
+    src/fragmentassembler.cpp \
+    src/latencytracker.cpp \
+    src/networkclock.cpp \
+    src/clockestimator.cpp \
+    src/unreliablechannel.cpp \
+    src/statetable.cpp \
+    src/snapshothistory.cpp \
+    src/lockstep.cpp \
+    src/payloadcompressor.cpp \
+    src/networkstatistics.cpp \
+    src/trace.cpp \
+    src/serverbeacon.cpp \
+    src/serverdiscovery.cpp \
+    src/resumeregistry.cpp \
+    src/nameregistry.cpp
 
 OTHER_FILES += \
     qtc_packaging/debian_harmattan/rules \
@@ -22,7 +71,7 @@ OTHER_FILES += \
     qtc_packaging/debian_harmattan/changelog
 
 contains(MEEGO_EDITION,harmattan) {
-    headers.files = src/include/connectionmanager.h
+    headers.files = src/include/connectionmanager.h src/include/networkstatistics.h
     headers.path = /usr/include/battleqt/
     target.path = /usr/lib/battleqt/
     INSTALLS += target
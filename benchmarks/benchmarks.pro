@@ -0,0 +1,17 @@
+# Loopback benchmarks of Server and Client, no GUI and no network session.
+# Build BattleQt.pro first, then run for example
+#   ./networkbenchmark -xml -o results.xml
+# to get results that can be compared across commits.
+
+TEMPLATE = app
+TARGET = networkbenchmark
+
+QT += network testlib
+QT -= gui
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../src
+LIBS += -L$$OUT_PWD/.. -lBattleQt -lz
+
+SOURCES += networkbenchmark.cpp
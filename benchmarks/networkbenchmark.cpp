@@ -0,0 +1,217 @@
+#include <QtTest/QtTest>
+#include "server.h"
+#include "client.h"
+
+// every wait gives up after this long so a broken build fails instead of hanging
+static const int Timeout = 10000;
+
+class NetworkBenchmark : public QObject
+{
+    Q_OBJECT
+public:
+    NetworkBenchmark();
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void handshake();
+    void pingRoundTrip_data();
+    void pingRoundTrip();
+    void smallMessages_data();
+    void smallMessages();
+    void largePayload_data();
+    void largePayload();
+
+    void onCreated(QString ip, QString port);
+    void onMessageRead();
+    void onDataRead(QByteArray data);
+    void onLatencyUpdated(QVariantMap statistics);
+
+private:
+    Client* joinedClient();
+    bool waitUntil(const int* counter, int count);
+
+    Server* m_server;
+    Client* m_client;
+    QString m_port;
+    QVariantMap m_latency;
+    int m_created;
+    int m_messages;
+    int m_data;
+    int m_pongs;
+};
+
+NetworkBenchmark::NetworkBenchmark() :
+    m_server(0),
+    m_client(0),
+    m_created(0),
+    m_messages(0),
+    m_data(0),
+    m_pongs(0)
+{
+}
+
+bool NetworkBenchmark::waitUntil(const int* counter, int count)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (*counter < count && timer.elapsed() < Timeout) {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 50);
+    }
+    return *counter >= count;
+}
+
+Client* NetworkBenchmark::joinedClient()
+{
+    Client* client = new Client(this);
+    client->setPlayerName("bench");
+    QSignalSpy spy(client, SIGNAL(joinSuccess(QString)));
+    client->join("127.0.0.1", m_port);
+    QElapsedTimer timer;
+    timer.start();
+    while (spy.isEmpty() && timer.elapsed() < Timeout) {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 50);
+    }
+    if (spy.isEmpty()) {
+        delete client;
+        return 0;
+    }
+    return client;
+}
+
+void NetworkBenchmark::initTestCase()
+{
+    m_server = new Server(this);
+    m_server->setPlayerName("host");
+    connect(m_server, SIGNAL(createSuccess(QString,QString)), this, SLOT(onCreated(QString,QString)));
+    connect(m_server, SIGNAL(messageRead(QString,QString)), this, SLOT(onMessageRead()));
+    m_server->create();
+    QVERIFY(waitUntil(&m_created, 1));
+
+    m_client = joinedClient();
+    QVERIFY(m_client);
+    connect(m_client, SIGNAL(dataRead(QByteArray)), this, SLOT(onDataRead(QByteArray)));
+    connect(m_client, SIGNAL(latencyUpdated(QVariantMap)), this, SLOT(onLatencyUpdated(QVariantMap)));
+}
+
+void NetworkBenchmark::cleanupTestCase()
+{
+    if (m_client)
+        m_client->close();
+    m_server->close();
+}
+
+void NetworkBenchmark::onCreated(QString ip, QString port)
+{
+    Q_UNUSED(ip);
+    m_port = port;
+    ++m_created;
+}
+
+void NetworkBenchmark::onMessageRead()
+{
+    ++m_messages;
+}
+
+void NetworkBenchmark::onDataRead(QByteArray data)
+{
+    Q_UNUSED(data);
+    ++m_data;
+}
+
+void NetworkBenchmark::onLatencyUpdated(QVariantMap statistics)
+{
+    m_latency = statistics;
+    ++m_pongs;
+}
+
+void NetworkBenchmark::handshake()
+{
+    // connect, hello, password and username until the client is welcomed
+    QBENCHMARK {
+        Client* client = joinedClient();
+        QVERIFY(client);
+        client->close();
+        delete client;
+    }
+}
+
+void NetworkBenchmark::pingRoundTrip_data()
+{
+    QTest::addColumn<QString>("statistic");
+    QTest::newRow("min") << "min";
+    QTest::newRow("p50") << "p50";
+    QTest::newRow("p99") << "p99";
+    QTest::newRow("jitter") << "jitter";
+}
+
+void NetworkBenchmark::pingRoundTrip()
+{
+    QFETCH(QString, statistic);
+    // one ping in flight at a time, the tracker keeps the last 128 samples
+    const int pings = 200;
+    for (int i = 0; i < pings; ++i) {
+        const int expected = m_pongs + 1;
+        m_client->ping();
+        QVERIFY(waitUntil(&m_pongs, expected));
+    }
+    QVERIFY(m_latency.contains(statistic));
+    QTest::setBenchmarkResult(m_latency.value(statistic).toReal(), QTest::WalltimeMilliseconds);
+}
+
+void NetworkBenchmark::smallMessages_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<int>("count");
+    QTest::newRow("16 bytes") << 16 << 10000;
+    QTest::newRow("256 bytes") << 256 << 5000;
+}
+
+void NetworkBenchmark::smallMessages()
+{
+    QFETCH(int, size);
+    QFETCH(int, count);
+    // client to server, timed until the last one has been parsed
+    const QString message(size, QChar('x'));
+    m_messages = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < count; ++i) {
+        m_client->sendMessage(message);
+    }
+    QVERIFY(waitUntil(&m_messages, count));
+    const qint64 nsecs = qMax(Q_INT64_C(1), timer.nsecsElapsed());
+    QTest::setBenchmarkResult(qreal(count) * size * 1e9 / nsecs, QTest::BytesPerSecond);
+}
+
+void NetworkBenchmark::largePayload_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::newRow("64 KiB") << 64 * 1024;
+    QTest::newRow("1 MiB") << 1024 * 1024;
+    QTest::newRow("8 MiB") << 8 * 1024 * 1024;
+}
+
+void NetworkBenchmark::largePayload()
+{
+    QFETCH(int, size);
+    // server to client, fragmented and interleaved with control frames;
+    // incompressible bytes so compression does not flatter the result
+    QByteArray data(size, 0);
+    qsrand(size);
+    for (int i = 0; i < size; ++i) {
+        data[i] = char(qrand());
+    }
+    m_data = 0;
+    QElapsedTimer timer;
+    timer.start();
+    m_server->sendData(data);
+    QVERIFY(waitUntil(&m_data, 1));
+    const qint64 nsecs = qMax(Q_INT64_C(1), timer.nsecsElapsed());
+    QTest::setBenchmarkResult(qreal(size) * 1e9 / nsecs, QTest::BytesPerSecond);
+}
+
+QTEST_MAIN(NetworkBenchmark)
+
+#include "networkbenchmark.moc"
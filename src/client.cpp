@@ -1,16 +1,32 @@
 #include "client.h"
+#include "networkclock.h"
+#include "trace.h"
+#include "unreliablechannel.h"
 #include <QTcpSocket>
-#include <QStringList>
+#include <QTimer>
+#include <QElapsedTimer>
 
 Client::Client(QObject *parent) :
     QObject(parent),
     m_client(NULL),
-    m_pingTime(NULL),
+    m_receivedAt(0),
+    m_pingTimer(new QTimer(this)),
+    m_heartbeatTimer(new QTimer(this)),
+    m_missedHeartbeats(0),
+    m_statisticsTimer(new QTimer(this)),
+    m_writer(NULL),
+    m_channel(NULL),
+    m_version(0),
+    m_capabilities(0),
+    m_received(0),
     m_joined(false),
-    blockSize(0),
     m_welcome(false),
-    m_closed(false)
+    m_closed(false),
+    m_resuming(false)
 {
+    connect(m_pingTimer, SIGNAL(timeout()), this, SLOT(ping()));
+    connect(m_heartbeatTimer, SIGNAL(timeout()), this, SLOT(checkHeartbeat()));
+    connect(m_statisticsTimer, SIGNAL(timeout()), this, SLOT(flushStatistics()));
 }
 
 void Client::setPassword(QString password)
@@ -23,127 +39,570 @@ void Client::setPlayerName(QString playerName)
     m_player = playerName;
 }
 
+void Client::setOptions(const ConnectionOptions& options)
+{
+    m_options = options;
+    m_compressor.setDictionary(m_options.compressionDictionary);
+    if (m_writer)
+        m_writer->setOptions(m_options);
+    if (m_options.statisticsIntervalMsecs > 0) {
+        m_statisticsTimer->start(m_options.statisticsIntervalMsecs);
+    } else {
+        m_statisticsTimer->stop();
+    }
+    updatePingTimer();
+    updateHeartbeatTimer();
+}
+
+void Client::updatePingTimer()
+{
+    if (m_welcome && m_options.pingIntervalMsecs > 0) {
+        m_pingTimer->start(m_options.pingIntervalMsecs);
+    } else {
+        m_pingTimer->stop();
+    }
+}
+
+void Client::updateHeartbeatTimer()
+{
+    m_missedHeartbeats = 0;
+    if (m_welcome && (m_capabilities & Protocol::KeepAlive) && m_options.heartbeatIntervalMsecs > 0) {
+        m_heartbeatTimer->start(m_options.heartbeatIntervalMsecs);
+    } else {
+        m_heartbeatTimer->stop();
+    }
+}
+
+void Client::checkHeartbeat()
+{
+    // whatever arrived since the last check answers for the server
+    const qint64 silentMsecs = (NetworkClock::currentTimeUsecs() - m_receivedAt) / 1000;
+    if (silentMsecs < m_options.heartbeatIntervalMsecs) {
+        m_missedHeartbeats = 0;
+        return;
+    }
+    if (m_missedHeartbeats >= m_options.heartbeatMisses) {
+        qDebug("server stopped answering");
+        if (canResume()) {
+            interrupt();
+        } else {
+            fail("timeout");
+        }
+        return;
+    }
+    ++m_missedHeartbeats;
+    sendFrame(Protocol::Heartbeat);
+}
+
 void Client::join(QString ip, QString port)
 {
     qDebug("joining");
+    m_ip = ip;
+    m_port = port;
+    m_otherPlayerName.clear();
+    m_resumeToken.clear();
+    m_received = 0;
+    m_replay = ReplayState();
+    openConnection();
+    qDebug("starting to connect host");
+}
+
+void Client::resume()
+{
+    if (m_client || m_resumeToken.isEmpty())
+        return;
+    qDebug("resuming session with %s", qPrintable(m_otherPlayerName));
+    m_resuming = true;
+    m_version = 0;
+    m_decoder.reset();
+    m_assembler.clear();
+    openConnection();
+}
+
+void Client::openConnection()
+{
     m_client = new QTcpSocket(this);
     connect(m_client, SIGNAL(connected()), this, SLOT(onConnected()));
     connect(m_client, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
     connect(m_client, SIGNAL(readyRead()), this, SLOT(readMessage()));
     connect(m_client, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(handlerError(QAbstractSocket::SocketError)));
-    m_client->connectToHost(ip, port.toUInt());
-    qDebug("starting to connect host");
+    m_writer = new FrameWriter(m_client, this);
+    m_writer->setOptions(m_options);
+    connect(m_writer, SIGNAL(sendProgress(qint64,qint64)), this, SIGNAL(sendProgress(qint64,qint64)));
+    connect(m_writer, SIGNAL(congestionChanged(bool)), this, SIGNAL(congestionChanged(bool)));
+    connect(m_writer, SIGNAL(stalled()), this, SLOT(onStalled()));
+    m_client->connectToHost(m_ip, m_port.toUInt());
 }
 
-void Client::sendMessage(QString message, bool internal)
-{
-    QByteArray block;
-    QDataStream out(&block, QIODevice::WriteOnly);
-    out.setVersion(QDataStream::Qt_4_0);
-    out << (quint16)0;
-    out << message;
-    out.device()->seek(0);
-    out << (quint16)(block.size() - sizeof(quint16));
-    qDebug("client sending message: %s", qPrintable(QString(block)));
-    if ((m_welcome && m_client) || internal) {
-        m_client->write(block);
-        if (!internal) {
-            emit messageSent();
-        }
-    } else if (!m_welcome || m_client) {
+void Client::dropConnection()
+{
+    // nothing of the old connection may report anything any more
+    disconnect(m_client, 0, this, 0);
+    m_client->abort();
+    m_client->deleteLater();
+    m_client = NULL;
+    m_writer->deleteLater();
+    m_writer = NULL;
+    if (m_channel) {
+        m_channel->deleteLater();
+        m_channel = NULL;
+    }
+}
+
+bool Client::canResume() const
+{
+    return m_welcome && !m_closed && !m_resumeToken.isEmpty() && m_options.resumeTimeoutMsecs > 0;
+}
+
+void Client::interrupt()
+{
+    qDebug("connection to server lost, session can be resumed");
+    m_welcome = false;
+    m_joined = false;
+    m_pingTimer->stop();
+    m_heartbeatTimer->stop();
+    flushStatistics();
+    m_replay = m_writer->takeReplayState();
+    dropConnection();
+    // the server sends its state whole after resuming, the application
+    // keeps seeing changes against what it had
+    m_snapshots.clear();
+    emit connectionLost();
+}
+
+void Client::onResumed(const QByteArray& payload)
+{
+    quint64 serverReceived = 0;
+    if (!Protocol::decodeResumed(payload, &serverReceived)
+            || !FrameWriter::canReplay(m_replay, serverReceived)) {
+        // the server keeps the player until its own timeout
+        qDebug("cannot replay what the server missed");
+        m_resuming = false;
+        dropConnection();
+        emit resumeFailed("rejected");
+        return;
+    }
+    qDebug("session resumed");
+    m_resuming = false;
+    m_welcome = true;
+    m_writer->setReplayEnabled(true);
+    m_writer->replay(m_replay, serverReceived);
+    m_replay = ReplayState();
+    updatePingTimer();
+    updateHeartbeatTimer();
+    emit resumed();
+}
+
+void Client::sendMessage(QString message)
+{
+    if (m_welcome && m_client) {
+        sendPayload(Protocol::Message, Protocol::encodeText(message, m_capabilities));
+        emit messageSent();
+    } else {
         emit messageError();
     }
 }
 
+void Client::sendData(const QByteArray& data)
+{
+    if (m_welcome && m_client) {
+        sendPayload(Protocol::Data, data);
+        emit messageSent();
+    } else {
+        emit messageError();
+    }
+}
+
+void Client::sendUnreliable(const QByteArray& data)
+{
+    // no error either way, datagrams may be lost anyway
+    if (m_welcome && m_channel)
+        m_channel->send(data);
+}
+
+void Client::sendInput(const QByteArray& payload)
+{
+    if (m_welcome && m_client)
+        sendPayload(Protocol::Input, payload);
+}
+
+void Client::sendFrame(quint8 opcode, const QByteArray& payload)
+{
+    m_writer->writeFrame(opcode, payload);
+}
+
+void Client::sendPayload(quint8 opcode, const QByteArray& payload)
+{
+    QByteArray compressed;
+    if ((m_capabilities & Protocol::Compression) && m_options.compressionThreshold > 0
+            && payload.size() >= m_options.compressionThreshold
+            && m_compressor.compress(payload, &compressed)) {
+        sendFrame(opcode | Protocol::CompressedFlag, compressed);
+        emit compressionUpdated(m_compressor.statistics());
+    } else {
+        sendFrame(opcode, payload);
+    }
+}
+
+quint32 Client::offeredCapabilities() const
+{
+    quint32 capabilities = Protocol::SupportedCapabilities;
+    if (m_options.unreliableChannel)
+        capabilities |= Protocol::Unreliable;
+    if (m_options.resumeTimeoutMsecs > 0)
+        capabilities |= Protocol::Resumable;
+    return capabilities;
+}
+
 void Client::ping()
 {
-    m_pingTime = new QTime;
-    m_pingTime->start();
-    sendMessage("ping", true);
+    if (!m_client)
+        return;
+    sendFrame(Protocol::Ping, Protocol::encodePing(m_latency.startPing(), NetworkClock::currentTimeUsecs()));
 }
 
 void Client::close()
 {
+    m_resuming = false;
+    m_resumeToken.clear();
+    m_replay = ReplayState();
     if (m_client) {
         m_closed = true;
+        // tells the server not to keep the session around for us
+        if (m_welcome && (m_capabilities & Protocol::Resumable)) {
+            sendFrame(Protocol::Reject, Protocol::encodeText("leave", m_capabilities));
+            m_writer->flush();
+        }
         m_client->disconnectFromHost();
         qDebug("closing connection to server");
+    } else if (!m_closed && !m_otherPlayerName.isEmpty()) {
+        // interrupted, there is no connection left to close
+        m_closed = true;
+        m_resuming = false;
+        m_state.clear();
+        emit partSuccess();
     }
 }
 
 void Client::readMessage()
 {
-    QDataStream in(m_client);
-    in.setVersion(QDataStream::Qt_4_0);
-
-    if (blockSize == 0) {
-        if (m_client->bytesAvailable() < (int)sizeof(quint16))
-            return;
-
-        in >> blockSize;
+    // drain every complete frame, several may have arrived in one segment
+    m_receivedAt = NetworkClock::currentTimeUsecs();
+    QElapsedTimer timer;
+    timer.start();
+    const qint64 available = m_client->bytesAvailable();
+    TRACE(Frames, ReadBegin, available, 0);
+    Protocol::Frame frame;
+    int frames = 0;
+    while (m_client->state() == QAbstractSocket::ConnectedState && m_decoder.readFrame(m_client, &frame)) {
+        ++frames;
+        ++m_statistics.framesIn;
+        ++m_statistics.framesInByOpcode[frame.opcode & ~Protocol::CompressedFlag];
+        TRACE(Frames, FrameReceived, frame.opcode, frame.payload.size());
+        parseFrame(frame);
+    }
+    TRACE(Frames, ReadEnd, frames, 0);
+    m_statistics.bytesIn += available - m_client->bytesAvailable();
+    m_statistics.parseNsecs += timer.nsecsElapsed();
+    if (m_decoder.hasError()) {
+        qDebug("malformed frame or legacy server");
+        fail("version");
     }
-
-    if (m_client->bytesAvailable() < blockSize)
-        return;
-
-    QString message;
-    in >> message;
-    blockSize = 0;
-    parseMessage(message);
 }
 
-void Client::parseMessage(QString message)
+void Client::parseFrame(const Protocol::Frame& frame)
 {
-    qDebug("parsing message from server: %s", qPrintable(message));
-    QStringList list = message.split(" ");
-    QString command = list.first();
-    if (command != "username" && !m_welcome) {
-        onWelcomeFail();
-        return;
-    } else if (command == "username" && m_welcome) {
-        return;
-    } else if (command == "username" && !m_welcome) {
-        if (list.size() == 2) {
-            onWelcomeSuccess(list.at(1));
-        } else {
+    if (!m_welcome) {
+        switch (frame.opcode) {
+        case Protocol::Hello:
+            if (!Protocol::decodeHello(frame.payload, &m_version, &m_capabilities)
+                    || m_version < Protocol::MinimumVersion) {
+                fail("version");
+            } else {
+                // legacy servers confirm nothing and keep talking UTF-16
+                m_capabilities &= offeredCapabilities();
+                m_writer->setFragmentationEnabled(m_capabilities & Protocol::Fragments);
+                if (!m_resuming) {
+                    sendFrame(Protocol::Password, Protocol::encodeText(m_password, m_capabilities));
+                } else if (m_capabilities & Protocol::Resumable) {
+                    sendFrame(Protocol::Resume, Protocol::encodeResume(m_resumeToken, m_received));
+                } else {
+                    m_resuming = false;
+                    dropConnection();
+                    emit resumeFailed("rejected");
+                }
+            }
+            break;
+        case Protocol::Reject:
+            if (m_resuming) {
+                qDebug("server could not resume the session");
+                m_resuming = false;
+                dropConnection();
+                emit resumeFailed("rejected");
+            } else {
+                onRejected(Protocol::decodeText(frame.payload, m_capabilities));
+            }
+            break;
+        case Protocol::Resumed:
+            if (m_resuming) {
+                onResumed(frame.payload);
+            } else {
+                onWelcomeFail();
+            }
+            break;
+        case Protocol::UdpOffer:
+            if (m_version) {
+                onUdpOffer(frame.payload);
+            } else {
+                onWelcomeFail();
+            }
+            break;
+        case Protocol::Username:
+            if (m_version && m_otherPlayerName.isEmpty()) {
+                onWelcomeSuccess(Protocol::decodeText(frame.payload, m_capabilities));
+            } else {
+                onWelcomeFail();
+            }
+            break;
+        case Protocol::Joined:
+            if ((m_capabilities & Protocol::NameCheck) && !m_otherPlayerName.isEmpty()) {
+                onJoined();
+            } else {
+                onWelcomeFail();
+            }
+            break;
+        default:
             onWelcomeFail();
+            break;
         }
         return;
     }
 
-    if (m_welcome && command == "servermessage") {
-        message.remove(0, 14);
-        emit messageRead(message);
-    } else if (command == "ping") {
-        sendMessage("pong", true);
-    } else if (command == "pong") {
-        if (m_pingTime) {
-            emit pong(m_pingTime->elapsed());
-            delete m_pingTime;
-            m_pingTime = 0;
-        } else {
-            emit pong(-1);
+    if (frame.opcode & Protocol::CompressedFlag) {
+        Protocol::Frame plain;
+        plain.opcode = frame.opcode & ~Protocol::CompressedFlag;
+        if (!(m_capabilities & Protocol::Compression) || !m_compressor.decompress(frame.payload, &plain.payload)) {
+            qDebug("undecodable compressed frame from server");
+            fail("unknown");
+            return;
         }
+        emit compressionUpdated(m_compressor.statistics());
+        parseFrame(plain);
+        return;
+    }
+
+    // numbered the same way the server's writer numbers them, see FrameWriter::replay
+    if (Protocol::isReplayable(frame.opcode))
+        ++m_received;
+
+    switch (frame.opcode) {
+    case Protocol::Message:
+        emit messageRead(Protocol::decodeText(frame.payload, m_capabilities));
+        break;
+    case Protocol::Data:
+        emit dataRead(frame.payload);
+        break;
+    case Protocol::FragmentBegin:
+    case Protocol::FragmentData:
+        onFragment(frame);
+        break;
+    case Protocol::Snapshot:
+        onSnapshot(frame.payload);
+        break;
+    case Protocol::TickBatch:
+        TRACE(Lockstep, TickReceived, frame.payload.size(), 0);
+        emit tickRead(frame.payload);
+        break;
+    case Protocol::Ping:
+        onPing(frame.payload);
+        break;
+    case Protocol::Pong:
+        onPong(frame.payload);
+        break;
+    case Protocol::Heartbeat:
+        sendFrame(Protocol::HeartbeatAck);
+        break;
+    case Protocol::Reject:
+        // the server is going away for good
+        onRejected(Protocol::decodeText(frame.payload, m_capabilities));
+        break;
+    case Protocol::ResumeToken:
+        m_resumeToken = frame.payload;
+        break;
+    case Protocol::UdpOffer:
+        // offered again after resuming
+        onUdpOffer(frame.payload);
+        break;
+    default:
+        // discard anything else, heartbeat acks only had to arrive
+        break;
     }
-    // discard message if none of those
 }
 
 void Client::onWelcomeSuccess(QString otherPlayerName)
 {
     m_otherPlayerName = otherPlayerName;
-    sendMessage("username " + m_player, true);
+    sendFrame(Protocol::Username, Protocol::encodeText(m_player, m_capabilities));
+    // the server numbers our frames from here on, before its token arrives
+    m_writer->setReplayEnabled(m_capabilities & Protocol::Resumable);
+    // a server checking names confirms ours before we are in
+    if (!(m_capabilities & Protocol::NameCheck))
+        onJoined();
+}
+
+void Client::onJoined()
+{
     m_welcome = true;
+    updatePingTimer();
+    updateHeartbeatTimer();
     emit joinSuccess(m_otherPlayerName);
 }
 
 void Client::onWelcomeFail()
 {
-    m_client->disconnectFromHost();
-    emit joinError("untrusted");
+    fail("untrusted");
+}
+
+void Client::onRejected(QString reason)
+{
+    qDebug("server rejected the connection: %s", qPrintable(reason));
+    if (reason == "version") {
+        fail("version");
+    } else if (reason == "auth") {
+        fail("refused");
+    } else if (reason == "name") {
+        fail("name");
+    } else if (reason == "closed") {
+        fail("closed");
+    } else {
+        fail("unknown");
+    }
+}
+
+void Client::onFragment(const Protocol::Frame& frame)
+{
+    Protocol::Frame complete;
+    qint64 received = 0;
+    qint64 total = 0;
+    const bool done = m_assembler.addFragment(frame, &complete, &received, &total);
+    if (m_assembler.hasError()) {
+        qDebug("broken fragment stream from server");
+        fail("unknown");
+        return;
+    }
+    emit receiveProgress(received, total);
+    if (done) {
+        parseFrame(complete);
+    }
+}
+
+void Client::onUdpOffer(const QByteArray& payload)
+{
+    quint16 port = 0;
+    quint32 token = 0;
+    if (m_channel || !(m_capabilities & Protocol::Unreliable)
+            || !Protocol::decodeUdpOffer(payload, &port, &token))
+        return;
+    m_channel = new UnreliableChannel(token, this);
+    if (!m_channel->bind()) {
+        qDebug("could not bind UDP socket, continuing without unreliable channel");
+        delete m_channel;
+        m_channel = NULL;
+        return;
+    }
+    connect(m_channel, SIGNAL(datagramRead(QByteArray)), this, SIGNAL(unreliableRead(QByteArray)));
+    m_channel->connectToPeer(m_client->peerAddress(), port);
+}
+
+void Client::onSnapshot(const QByteArray& payload)
+{
+    quint32 id = 0;
+    StateTable state;
+    if (!m_snapshots.apply(payload, &id, &state)) {
+        qDebug("dropping undecodable snapshot");
+        return;
+    }
+    TRACE(Replication, SnapshotApplied, id, payload.size());
+    sendFrame(Protocol::SnapshotAck, Protocol::encodeSnapshotAck(id));
+
+    // report against what the application saw last, deltas are against the
+    // acknowledged snapshot which may be older
+    StateTable::const_iterator it = m_state.constBegin();
+    for (; it != m_state.constEnd(); ++it) {
+        if (!state.contains(it.key()))
+            emit stateRemoved(it.key());
+    }
+    for (it = state.constBegin(); it != state.constEnd(); ++it) {
+        // by field name, an entry set again may list its fields in another order
+        const QVariantMap previous = m_state.value(it.key()).toMap();
+        QVariantMap fields;
+        for (int i = 0; i < it->fields.size(); ++i) {
+            QVariantMap::const_iterator field = previous.constFind(it->fields.at(i));
+            if (field == previous.constEnd() || it->values.at(i) != field.value())
+                fields.insert(it->fields.at(i), it->values.at(i));
+        }
+        if (!fields.isEmpty())
+            emit stateChanged(it.key(), fields);
+    }
+    m_state = state;
+}
+
+void Client::onPing(const QByteArray& payload)
+{
+    quint32 sequence = 0;
+    qint64 originate = 0;
+    if (!Protocol::decodePing(payload, &sequence, &originate))
+        return;
+    sendFrame(Protocol::Pong, Protocol::encodePong(sequence, originate, m_receivedAt,
+                                                   NetworkClock::currentTimeUsecs()));
+}
+
+void Client::onPong(const QByteArray& payload)
+{
+    const qint64 arrival = m_receivedAt;
+    quint32 sequence = 0;
+    qint64 originate = 0;
+    qint64 received = 0;
+    qint64 transmit = 0;
+    if (!Protocol::decodePong(payload, &sequence, &originate, &received, &transmit))
+        return;
+    const qint64 rtt = m_latency.finishPing(sequence);
+    if (rtt < 0)
+        return; // stray or stale pong
+    emit pong(int((rtt + 500) / 1000));
+    emit latencyUpdated(m_latency.statistics());
+
+    if (originate && received && transmit) {
+        m_clock.addSample(originate, received, transmit, arrival);
+        emit clockUpdated(m_clock.offsetUsecs(), m_clock.uncertaintyUsecs());
+    }
+}
+
+void Client::fail(QString error)
+{
+    // report only once, the socket error that follows the disconnect is ours
+    disconnect(m_client, SIGNAL(error(QAbstractSocket::SocketError)),
+               this, SLOT(handlerError(QAbstractSocket::SocketError)));
+    // final, the disconnect that follows must not try to resume
+    m_resumeToken.clear();
+    m_client->abort();
+    m_joined = false;
+    emit joinError(error);
 }
 
 void Client::handlerError(QAbstractSocket::SocketError error)
 {
+    if (m_resuming) {
+        qDebug("could not reach server to resume: %s", qPrintable(m_client->errorString()));
+        m_resuming = false;
+        dropConnection();
+        emit resumeFailed("retry");
+        return;
+    }
+    if (canResume()) {
+        interrupt();
+        return;
+    }
     switch (error) {
         case QAbstractSocket::RemoteHostClosedError:
             qDebug("Server closed connection");
@@ -168,12 +627,41 @@ void Client::handlerError(QAbstractSocket::SocketError error)
 void Client::onConnected()
 {
     m_joined = true;
-    if (!m_password.isEmpty())
-        sendMessage("password " + m_password, true);
+    sendFrame(Protocol::Hello, Protocol::encodeHello(Protocol::Version, offeredCapabilities()));
+}
+
+void Client::onStalled()
+{
+    qDebug("server is not keeping up, disconnecting");
+    fail("closed");
+}
+
+void Client::flushStatistics()
+{
+    NetworkStatistics statistics = m_statistics;
+    if (m_writer)
+        statistics += m_writer->takeStatistics();
+    m_statistics = NetworkStatistics();
+    if (!statistics.isEmpty() || statistics.sendQueueBytes > 0)
+        emit statisticsUpdated(statistics);
 }
 
 void Client::onDisconnected()
 {
+    if (canResume()) {
+        interrupt();
+        return;
+    }
+    m_pingTimer->stop();
+    m_heartbeatTimer->stop();
+    flushStatistics();
+    m_writer->clear();
+    if (m_channel) {
+        m_channel->deleteLater();
+        m_channel = NULL;
+    }
+    m_snapshots.clear();
+    m_state.clear();
     if (m_closed) {
         emit partSuccess();
     }
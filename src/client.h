@@ -2,10 +2,21 @@
 #define CLIENT_H
 
 #include <QObject>
-#include <QTime>
 #include <QAbstractSocket>
+#include <QVariantMap>
+#include "framedecoder.h"
+#include "fragmentassembler.h"
+#include "connectionoptions.h"
+#include "latencytracker.h"
+#include "clockestimator.h"
+#include "snapshothistory.h"
+#include "payloadcompressor.h"
+#include "framewriter.h"
+#include "include/networkstatistics.h"
 
 class QTcpSocket;
+class UnreliableChannel;
+class QTimer;
 
 class Client : public QObject
 {
@@ -14,42 +25,114 @@ public:
     explicit Client(QObject *parent = 0);
     void setPassword(QString password);
     void setPlayerName(QString playerName);
+
+public slots:
+    void setOptions(const ConnectionOptions& options);
     void join(QString ip, QString port);
-    void sendMessage(QString message, bool internal);
+    // connects again after connectionLost() and continues the session
+    void resume();
+    void sendMessage(QString message);
+    void sendData(const QByteArray& data);
+    void sendUnreliable(const QByteArray& data);
+    void sendInput(const QByteArray& payload);
     void ping();
     void close();
 
 signals:
     void messageRead(QString message);
+    void dataRead(QByteArray data);
+    void unreliableRead(QByteArray data);
     void messageSent();
     void messageError();
     void joinSuccess(QString otherPlayer);
     void joinError(QString error);
     void partSuccess();
+    // dropped while joined, the session can be resumed for a while
+    void connectionLost();
+    void resumed();
+    // "rejected" when the server no longer knows the session, "retry" when
+    // it could not be reached
+    void resumeFailed(QString error);
     void pong(int msecs);
+    void latencyUpdated(QVariantMap statistics);
+    void compressionUpdated(QVariantMap statistics);
+    void congestionChanged(bool congested);
+    // counters since the previous update
+    void statisticsUpdated(NetworkStatistics statistics);
+    // how far the server's clock is ahead of ours
+    void clockUpdated(qint64 offsetUsecs, qint64 uncertaintyUsecs);
+    // replicated state, only the fields that changed
+    void stateChanged(QString key, QVariantMap fields);
+    void stateRemoved(QString key);
+    void tickRead(QByteArray payload);
+    void sendProgress(qint64 bytesSent, qint64 bytesTotal);
+    void receiveProgress(qint64 bytesReceived, qint64 bytesTotal);
 
 private slots:
     void readMessage();
     void handlerError(QAbstractSocket::SocketError error);
     void onConnected();
     void onDisconnected();
+    void onStalled();
+    void flushStatistics();
+    void checkHeartbeat();
 
 private:
-    void parseMessage(QString message);
+    void openConnection();
+    void dropConnection();
+    bool canResume() const;
+    void interrupt();
+    void onResumed(const QByteArray& payload);
+    void sendFrame(quint8 opcode, const QByteArray& payload = QByteArray());
+    // compressed when negotiated and large enough
+    void sendPayload(quint8 opcode, const QByteArray& payload);
+    quint32 offeredCapabilities() const;
+    void parseFrame(const Protocol::Frame& frame);
     void onWelcomeSuccess(QString otherPlayerName);
+    void onJoined();
     void onWelcomeFail();
+    void onRejected(QString reason);
+    void onFragment(const Protocol::Frame& frame);
+    void onUdpOffer(const QByteArray& payload);
+    void onSnapshot(const QByteArray& payload);
+    void onPing(const QByteArray& payload);
+    void onPong(const QByteArray& payload);
+    void updatePingTimer();
+    void updateHeartbeatTimer();
+    void fail(QString error);
 
     QString m_ip;
     QString m_port;
     QString m_player;
     QString m_password;
     QTcpSocket* m_client;
+    ConnectionOptions m_options;
     QString m_otherPlayerName;
-    QTime* m_pingTime;
+    LatencyTracker m_latency;
+    qint64 m_receivedAt;
+    ClockEstimator m_clock;
+    SnapshotHistory m_snapshots;
+    StateTable m_state;
+    QTimer* m_pingTimer;
+    QTimer* m_heartbeatTimer;
+    int m_missedHeartbeats;
+    QTimer* m_statisticsTimer;
+    NetworkStatistics m_statistics;
+    FrameDecoder m_decoder;
+    FrameWriter* m_writer;
+    FragmentAssembler m_assembler;
+    PayloadCompressor m_compressor;
+    UnreliableChannel* m_channel;
+    quint8 m_version;
+    quint32 m_capabilities;
+    QByteArray m_resumeToken;
+    // replayable frames received since joining
+    quint64 m_received;
+    ReplayState m_replay;
     bool m_joined;
-    quint16 blockSize;
     bool m_welcome;
     bool m_closed;
+    bool m_resuming;
 };
 
 #endif // CLIENT_H
@@ -0,0 +1,46 @@
+#include "clockestimator.h"
+
+// recent samples considered, older ones may predate clock drift
+static const int WindowSize = 16;
+
+ClockEstimator::ClockEstimator() :
+    m_best(-1)
+{
+}
+
+void ClockEstimator::addSample(qint64 originate, qint64 received, qint64 transmit, qint64 arrival)
+{
+    Sample sample;
+    sample.delay = qMax(Q_INT64_C(0), (arrival - originate) - (transmit - received));
+    sample.offset = ((received - originate) + (transmit - arrival)) / 2;
+    m_samples.append(sample);
+    if (m_samples.size() > WindowSize)
+        m_samples.removeFirst();
+
+    m_best = 0;
+    for (int i = 1; i < m_samples.size(); ++i) {
+        if (m_samples.at(i).delay < m_samples.at(m_best).delay)
+            m_best = i;
+    }
+}
+
+bool ClockEstimator::isValid() const
+{
+    return m_best >= 0;
+}
+
+qint64 ClockEstimator::offsetUsecs() const
+{
+    return isValid() ? m_samples.at(m_best).offset : 0;
+}
+
+qint64 ClockEstimator::uncertaintyUsecs() const
+{
+    return isValid() ? m_samples.at(m_best).delay / 2 : -1;
+}
+
+void ClockEstimator::clear()
+{
+    m_samples.clear();
+    m_best = -1;
+}
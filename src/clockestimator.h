@@ -0,0 +1,32 @@
+#ifndef CLOCKESTIMATOR_H
+#define CLOCKESTIMATOR_H
+
+#include <QList>
+
+// NTP style estimate of how far the peer's clock is ahead of ours. Samples
+// with the lowest round trip have the least asymmetric queueing in them, so
+// the best recent one wins
+class ClockEstimator
+{
+public:
+    ClockEstimator();
+    // originate and arrival on our clock, received and transmit on the peer's
+    void addSample(qint64 originate, qint64 received, qint64 transmit, qint64 arrival);
+    bool isValid() const;
+    qint64 offsetUsecs() const;
+    // the true offset is within this many microseconds of offsetUsecs()
+    qint64 uncertaintyUsecs() const;
+    void clear();
+
+private:
+    struct Sample
+    {
+        qint64 offset;
+        qint64 delay;
+    };
+
+    QList<Sample> m_samples;
+    int m_best;
+};
+
+#endif // CLOCKESTIMATOR_H
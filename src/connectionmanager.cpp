@@ -2,29 +2,133 @@
 #include "include/connectionmanager.h"
 #include "server.h"
 #include "client.h"
+#include "networkclock.h"
+#include "trace.h"
 
 #include <QNetworkAccessManager>
+#include <QNetworkInterface>
+#include <QSettings>
+#include <QThread>
+#include <QFile>
+#include <QTextStream>
+#include <QDateTime>
 
 ConnectionManagerPrivate::ConnectionManagerPrivate(ConnectionManager *parent) :
     QObject(parent),
     q_ptr(parent),
     m_session(NULL),
+    m_fastStartEnabled(true),
+    m_fastStarted(false),
     m_server(NULL),
     m_client(NULL),
+    m_clockOffset(0),
+    m_clockUncertainty(-1),
+    m_joinedBefore(false),
+    m_snapshotId(0),
+    m_ticksProduced(0),
+    m_inputTick(1),
+    m_tickRate(0),
+    m_stalledTick(0),
     m_multiPlayerModeEnabled(false),
     m_host(false),
-    m_closed(false)
+    m_retryCount(0),
+    m_closed(false),
+    m_networkThreadEnabled(false),
+    m_networkThread(NULL),
+    m_serverThreadCount(0)
 {
+    qRegisterMetaType<ConnectionOptions>("ConnectionOptions");
+    qRegisterMetaType<qint64>("qint64");
+    qRegisterMetaType<quint32>("quint32");
+    qRegisterMetaType<StateTable>("StateTable");
+    qRegisterMetaType<NetworkStatistics>("NetworkStatistics");
+    connect(&m_statisticsLogTimer, SIGNAL(timeout()), this, SLOT(writeStatisticsLog()));
+    connect(&m_tickTimer, SIGNAL(timeout()), this, SLOT(handleTick()));
+    m_retryTimer.setSingleShot(true);
+    connect(&m_retryTimer, SIGNAL(timeout()), this, SLOT(retryConnection()));
+    connect(&m_discovery, SIGNAL(serversChanged()), parent, SIGNAL(discoveredServersChanged()));
 }
 
 ConnectionManagerPrivate::~ConnectionManagerPrivate()
 {
-    m_session->close();
+    if (m_session)
+        m_session->close();
+    if (m_networkThread) {
+        // objects living in the network thread have no parent here, their
+        // deferred deletes run when the thread finishes
+        if (m_server)
+            m_server->deleteLater();
+        if (m_client)
+            m_client->deleteLater();
+        m_networkThread->quit();
+        m_networkThread->wait();
+    }
+}
+
+void ConnectionManagerPrivate::setNetworkThreadEnabled(bool enabled)
+{
+    m_networkThreadEnabled = enabled;
+}
+
+void ConnectionManagerPrivate::setServerThreadCount(int count)
+{
+    m_serverThreadCount = count < 0 ? QThread::idealThreadCount() : count;
+}
+
+void ConnectionManagerPrivate::setFastStartEnabled(bool enabled)
+{
+    m_fastStartEnabled = enabled;
+}
+
+// identifier of the configuration whose session opened last time
+static QString lastConfiguration()
+{
+    return QSettings("BattleQt", "network").value("lastConfiguration").toString();
+}
+
+bool ConnectionManagerPrivate::isAlreadyOnline()
+{
+    // a cached configuration that is still active needs no update round
+    const QString identifier = lastConfiguration();
+    if (!identifier.isEmpty()) {
+        const QNetworkConfiguration configuration = m_configManager.configurationFromIdentifier(identifier);
+        if (configuration.isValid() && (configuration.state() & QNetworkConfiguration::Active) == QNetworkConfiguration::Active)
+            return true;
+    }
+    // on desktops and LAN hosts the interfaces are up whether or not a
+    // bearer plugin manages them
+    foreach (const QNetworkInterface& networkInterface, QNetworkInterface::allInterfaces()) {
+        const QNetworkInterface::InterfaceFlags flags = networkInterface.flags();
+        if ((flags & QNetworkInterface::IsLoopBack) || !(flags & QNetworkInterface::IsUp)
+                || !(flags & QNetworkInterface::IsRunning))
+            continue;
+        if (!networkInterface.addressEntries().isEmpty())
+            return true;
+    }
+    return false;
+}
+
+void ConnectionManagerPrivate::moveToNetworkThread(QObject* object)
+{
+    if (!m_networkThreadEnabled)
+        return;
+    if (!m_networkThread) {
+        m_networkThread = new QThread(this);
+        m_networkThread->start();
+    }
+    object->moveToThread(m_networkThread);
 }
 
 void ConnectionManagerPrivate::startConnecting()
 {
     m_closed = false;
+    m_fastStarted = false;
+    m_multiPlayerModeEnabled = false;
+    if (m_fastStartEnabled && isAlreadyOnline()) {
+        qDebug("network already online, enabling multiplayer mode");
+        m_fastStarted = true;
+        finishConnecting();
+    }
     connect(&m_configManager, SIGNAL(updateCompleted()), this, SLOT(connectToNetwork()));
     connect(&m_networkUpdateTimer, SIGNAL(timeout()), this, SLOT(connectToNetwork()));
     qDebug("getting default access point");
@@ -55,11 +159,18 @@ void ConnectionManagerPrivate::connectToNetwork()
     const bool canStartIAP = (m_configManager.capabilities() & QNetworkConfigurationManager::CanStartAndStopInterfaces);
 
     if (!m_accessPoint.isValid() || !canStartIAP) {
+        if (m_fastStarted) {
+            // interfaces are up but not managed by a bearer, nothing to open
+            qDebug("no network session available, staying on the online interface");
+            return;
+        }
         qDebug("no network available");
         m_multiPlayerModeEnabled = false;
         emit q->networkUnavailable();
     } else {
         qDebug("creating network session");
+        if (m_session)
+            m_session->deleteLater();
         m_session = new QNetworkSession(m_accessPoint, this);
         connect(m_session, SIGNAL(opened()), this, SLOT(finishConnecting()));
         connect(m_session, SIGNAL(error(QNetworkSession::SessionError)), this,
@@ -78,6 +189,10 @@ void ConnectionManagerPrivate::connectToNetwork()
 void ConnectionManagerPrivate::finishConnecting()
 {
     Q_Q(ConnectionManager);
+    if (m_session && m_session->isOpen())
+        QSettings("BattleQt", "network").setValue("lastConfiguration", m_session->configuration().identifier());
+    if (m_multiPlayerModeEnabled)
+        return;
     qDebug("session opened, connected");
     m_multiPlayerModeEnabled = true;
     emit q->multiPlayerModeEnabled();
@@ -86,6 +201,11 @@ void ConnectionManagerPrivate::finishConnecting()
 void ConnectionManagerPrivate::handleNetworkError(QNetworkSession::SessionError error)
 {
     Q_Q(ConnectionManager);
+    if (m_fastStarted && !m_closed && isAlreadyOnline()) {
+        // the session was only a background check, the interface still works
+        qDebug() << "network session failed, staying on the online interface:" << error;
+        return;
+    }
     m_multiPlayerModeEnabled = false;
     if (!m_closed) {
         emit q->networkUnavailable();
@@ -106,7 +226,7 @@ void ConnectionManagerPrivate::handleServerError(QString error)
     } else {
         emit q->serverError(ConnectionManager::ServerGotUnknownError, "Server got unknown error");
     }
-    delete m_server;
+    m_server->deleteLater();
     m_server = 0;
     qDebug("server error");
 }
@@ -115,6 +235,9 @@ void ConnectionManagerPrivate::handleServerSuccess(QString ip, QString port)
 {
     Q_Q(ConnectionManager);
     m_host = true;
+    // the host is the time reference
+    m_clockOffset = 0;
+    m_clockUncertainty = 0;
     emit q->serverStarted(ip, port);
     qDebug("server started on ip: %s and port %s", qPrintable(ip), qPrintable(port));
 }
@@ -130,29 +253,274 @@ void ConnectionManagerPrivate::handleJoiningError(QString error)
         emit q->joiningError(ConnectionManager::ServerNotFound, "Server not found");
     } else if (error == "refused") {
         emit q->joiningError(ConnectionManager::ServerRefusedConnection, "Server not able to authenticate client");
+    } else if (error == "version") {
+        emit q->joiningError(ConnectionManager::ProtocolVersionMismatch, "Server speaks an incompatible protocol version");
     } else if (error == "unknown") {
         emit q->joiningError(ConnectionManager::ClientGotUnknownError, "Client got unknown error");
+    } else if (error == "timeout") {
+        emit q->joiningError(ConnectionManager::ServerNotResponding, "Server stopped responding");
+    } else if (error == "name") {
+        emit q->joiningError(ConnectionManager::PlayerNameTaken, "Another player in the game has the same name");
     }
+    m_retryTimer.stop();
     m_client->deleteLater();
     m_client = 0;
+    m_state.clear();
     qDebug("unable to join game");
 }
 
 void ConnectionManagerPrivate::handleJoiningSuccess(QString otherPlayer)
 {
     Q_Q(ConnectionManager);
+    m_otherPlayer = otherPlayer;
+    m_joinedBefore = true;
     emit q->joiningSucceeded(otherPlayer);
     qDebug("successfully joined a game with %s", qPrintable(otherPlayer));
 }
 
+void ConnectionManagerPrivate::handleConnectionLost()
+{
+    Q_Q(ConnectionManager);
+    if (!m_client)
+        return;
+    qDebug("connection to server lost, resuming");
+    m_retryCount = 0;
+    m_retryClock.start();
+    emit q->connectionInterrupted();
+    scheduleRetry();
+}
+
+void ConnectionManagerPrivate::scheduleRetry()
+{
+    if (m_retryClock.elapsed() >= m_options.resumeTimeoutMsecs) {
+        qDebug("server did not come back in time");
+        handleJoiningError("closed");
+        return;
+    }
+    // backs off quickly, a server that is back answers the next attempt
+    const int delay = qMin(250 << qMin(m_retryCount, 4), 4000);
+    ++m_retryCount;
+    m_retryTimer.start(delay);
+}
+
+void ConnectionManagerPrivate::retryConnection()
+{
+    if (m_client)
+        QMetaObject::invokeMethod(m_client, "resume");
+}
+
+void ConnectionManagerPrivate::handleResumeFailed(QString error)
+{
+    // queued from a client that was closed meanwhile
+    if (!m_client)
+        return;
+    if (error == "rejected") {
+        qDebug("server no longer knows the session");
+        handleJoiningError("closed");
+    } else {
+        scheduleRetry();
+    }
+}
+
+void ConnectionManagerPrivate::handleResumed()
+{
+    Q_Q(ConnectionManager);
+    m_retryTimer.stop();
+    ++m_statistics.reconnects;
+    qDebug("connection to server resumed after %d attempts", m_retryCount);
+    emit q->connectionResumed();
+}
+
 void ConnectionManagerPrivate::handleLeavingFromServer()
 {
     Q_Q(ConnectionManager);
     m_client->deleteLater();
     m_client = 0;
+    m_latency.clear();
+    m_compression.clear();
+    m_clockOffset = 0;
+    m_clockUncertainty = -1;
+    m_state.clear();
     emit q->leftFromGame();
 }
 
+void ConnectionManagerPrivate::handlePlayerMessage(QString playerName, QString message)
+{
+    Q_Q(ConnectionManager);
+    emit q->incomingPlayerMessage(playerName, message);
+    emit q->incomingMessage(message);
+}
+
+void ConnectionManagerPrivate::handlePlayerData(QString playerName, QByteArray data)
+{
+    Q_Q(ConnectionManager);
+    emit q->incomingPlayerData(playerName, data);
+    emit q->incomingData(data);
+}
+
+void ConnectionManagerPrivate::handlePlayerUnreliable(QString playerName, QByteArray data)
+{
+    Q_Q(ConnectionManager);
+    emit q->incomingPlayerUnreliable(playerName, data);
+    emit q->incomingUnreliable(data);
+}
+
+void ConnectionManagerPrivate::handleClientSendProgress(qint64 bytesSent, qint64 bytesTotal)
+{
+    Q_Q(ConnectionManager);
+    emit q->dataSendProgress(m_otherPlayer, bytesSent, bytesTotal);
+}
+
+void ConnectionManagerPrivate::handleClientReceiveProgress(qint64 bytesReceived, qint64 bytesTotal)
+{
+    Q_Q(ConnectionManager);
+    emit q->dataReceiveProgress(m_otherPlayer, bytesReceived, bytesTotal);
+}
+
+void ConnectionManagerPrivate::handlePlayerConnected(QString playerName)
+{
+    Q_Q(ConnectionManager);
+    m_players.append(playerName);
+    if (m_tickRate > 0)
+        m_lockstep.addPlayer(playerName);
+    emit q->playerConnected(playerName);
+}
+
+void ConnectionManagerPrivate::handlePlayerDisconnected(QString playerName)
+{
+    Q_Q(ConnectionManager);
+    m_players.removeOne(playerName);
+    m_lockstep.removePlayer(playerName);
+    // nobody to wait for anymore
+    releaseTicks();
+    m_latency.remove(playerName);
+    m_compression.remove(playerName);
+    m_connectionStatistics.remove(playerName);
+    emit q->playerDisconnected(playerName);
+}
+
+void ConnectionManagerPrivate::handleLatencyUpdated(QString playerName, QVariantMap statistics)
+{
+    Q_Q(ConnectionManager);
+    m_latency.insert(playerName, statistics);
+    emit q->latencyUpdated(playerName, statistics);
+}
+
+void ConnectionManagerPrivate::handleClientLatencyUpdated(QVariantMap statistics)
+{
+    Q_Q(ConnectionManager);
+    // stored under the empty name too, clients need not know the server's name
+    m_latency.insert(QString(), statistics);
+    emit q->latencyUpdated(m_otherPlayer, statistics);
+}
+
+void ConnectionManagerPrivate::handleCompressionUpdated(QString playerName, QVariantMap statistics)
+{
+    m_compression.insert(playerName, statistics);
+}
+
+void ConnectionManagerPrivate::handleClientCompressionUpdated(QVariantMap statistics)
+{
+    m_compression.insert(QString(), statistics);
+}
+
+void ConnectionManagerPrivate::handleCongestionChanged(QString playerName, bool congested)
+{
+    Q_Q(ConnectionManager);
+    if (congested) {
+        emit q->congestionStarted(playerName);
+    } else {
+        emit q->congestionEnded(playerName);
+    }
+}
+
+void ConnectionManagerPrivate::handleClientCongestionChanged(bool congested)
+{
+    handleCongestionChanged(m_otherPlayer, congested);
+}
+
+void ConnectionManagerPrivate::handleStatisticsUpdated(QString playerName, NetworkStatistics statistics)
+{
+    Q_Q(ConnectionManager);
+    // updates carry what happened since the previous one
+    m_statistics += statistics;
+    m_connectionStatistics[playerName] += statistics;
+    emit q->statisticsChanged();
+}
+
+void ConnectionManagerPrivate::handleClientStatisticsUpdated(NetworkStatistics statistics)
+{
+    handleStatisticsUpdated(QString(), statistics);
+}
+
+NetworkStatistics ConnectionManagerPrivate::totalStatistics() const
+{
+    NetworkStatistics total = m_statistics;
+    total.sendQueueBytes = 0;
+    foreach (const NetworkStatistics& statistics, m_connectionStatistics) {
+        total.sendQueueBytes += statistics.sendQueueBytes;
+    }
+    return total;
+}
+
+void ConnectionManagerPrivate::setStatisticsLog(QString fileName, int intervalMsecs)
+{
+    m_statisticsLog = fileName;
+    if (fileName.isEmpty() || intervalMsecs <= 0) {
+        m_statisticsLogTimer.stop();
+    } else {
+        m_statisticsLogTimer.start(intervalMsecs);
+    }
+}
+
+static void writeMap(QTextStream* out, const QString& prefix, const QVariantMap& map)
+{
+    QVariantMap::const_iterator it = map.constBegin();
+    for (; it != map.constEnd(); ++it) {
+        if (it.value().type() == QVariant::Map) {
+            writeMap(out, prefix + it.key() + '.', it.value().toMap());
+        } else {
+            *out << ' ' << prefix << it.key() << '=' << it.value().toString();
+        }
+    }
+}
+
+void ConnectionManagerPrivate::writeStatisticsLog()
+{
+    // one line per dump: timestamp followed by key=value pairs
+    QFile file(m_statisticsLog);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        qDebug("cannot write statistics to %s", qPrintable(m_statisticsLog));
+        return;
+    }
+    QTextStream out(&file);
+    out << QDateTime::currentDateTime().toString(Qt::ISODate);
+    writeMap(&out, QString(), totalStatistics().toVariantMap());
+    out << '\n';
+}
+
+void ConnectionManagerPrivate::handleClockUpdated(qint64 offsetUsecs, qint64 uncertaintyUsecs)
+{
+    Q_Q(ConnectionManager);
+    m_clockOffset = offsetUsecs;
+    m_clockUncertainty = uncertaintyUsecs;
+    emit q->clockSynchronized(offsetUsecs, uncertaintyUsecs);
+}
+
+void ConnectionManagerPrivate::handleStateChanged(QString key, QVariantMap fields)
+{
+    Q_Q(ConnectionManager);
+    m_state[key].setFields(fields);
+    emit q->stateChanged(key, fields);
+}
+
+void ConnectionManagerPrivate::handleStateRemoved(QString key)
+{
+    Q_Q(ConnectionManager);
+    m_state.remove(key);
+    emit q->stateRemoved(key);
+}
+
 void ConnectionManagerPrivate::handleMessageError()
 {
     Q_Q(ConnectionManager);
@@ -167,27 +535,54 @@ void ConnectionManagerPrivate::startServer(QString player, QString password)
     } else if (player.isEmpty()) {
         emit q->serverError(ConnectionManager::ServerHasInvalidPlayerName, "Player name not valid");
     } else {
-        m_server = new Server(this);
+        m_player = player;
+        m_players.clear();
+        // restart lockstep with the host under its player name
+        if (m_tickRate > 0)
+            setTickRate(m_tickRate);
+        m_server = new Server(m_networkThreadEnabled ? 0 : this);
         m_server->setPassword(password);
         m_server->setPlayerName(player);
+        m_server->setOptions(m_options);
+        m_server->setThreadCount(m_serverThreadCount);
         connect(m_server, SIGNAL(createSuccess(QString,QString)), this, SLOT(handleServerSuccess(QString,QString)));
         connect(m_server, SIGNAL(createFailure(QString)), this, SLOT(handleServerError(QString)));
-        connect(m_server, SIGNAL(playerConnected(QString)), q, SIGNAL(playerConnected(QString)));
-        connect(m_server, SIGNAL(playerDisconnected(QString)), q, SIGNAL(playerDisconnected(QString)));
-        connect(m_server, SIGNAL(messageRead(QString)), q, SIGNAL(incomingMessage(QString)));
+        connect(m_server, SIGNAL(playerConnected(QString)), this, SLOT(handlePlayerConnected(QString)));
+        connect(m_server, SIGNAL(playerDisconnected(QString)), this, SLOT(handlePlayerDisconnected(QString)));
+        connect(m_server, SIGNAL(messageRead(QString,QString)), this, SLOT(handlePlayerMessage(QString,QString)));
+        connect(m_server, SIGNAL(dataRead(QString,QByteArray)), this, SLOT(handlePlayerData(QString,QByteArray)));
+        connect(m_server, SIGNAL(unreliableRead(QString,QByteArray)),
+                this, SLOT(handlePlayerUnreliable(QString,QByteArray)));
+        connect(m_server, SIGNAL(inputRead(QString,QByteArray)), this, SLOT(handlePlayerInput(QString,QByteArray)));
         connect(m_server, SIGNAL(messageSent()), q, SIGNAL(messageSent()));
         connect(m_server, SIGNAL(messageError()), this, SLOT(handleMessageError()));
         connect(m_server, SIGNAL(pong(int)), q, SIGNAL(pong(int)));
-        m_server->create();
+        connect(m_server, SIGNAL(latencyUpdated(QString,QVariantMap)),
+                this, SLOT(handleLatencyUpdated(QString,QVariantMap)));
+        connect(m_server, SIGNAL(compressionUpdated(QString,QVariantMap)),
+                this, SLOT(handleCompressionUpdated(QString,QVariantMap)));
+        connect(m_server, SIGNAL(congestionChanged(QString,bool)), this, SLOT(handleCongestionChanged(QString,bool)));
+        connect(m_server, SIGNAL(statisticsUpdated(QString,NetworkStatistics)),
+                this, SLOT(handleStatisticsUpdated(QString,NetworkStatistics)));
+        connect(m_server, SIGNAL(sendProgress(QString,qint64,qint64)),
+                q, SIGNAL(dataSendProgress(QString,qint64,qint64)));
+        connect(m_server, SIGNAL(receiveProgress(QString,qint64,qint64)),
+                q, SIGNAL(dataReceiveProgress(QString,qint64,qint64)));
+        moveToNetworkThread(m_server);
+        QMetaObject::invokeMethod(m_server, "create");
     }
 }
 
 void ConnectionManagerPrivate::closeServer()
 {
     Q_Q(ConnectionManager);
-    m_server->close();
+    QMetaObject::invokeMethod(m_server, "close");
     m_server->deleteLater();
     m_server = 0;
+    m_latency.clear();
+    m_compression.clear();
+    m_players.clear();
+    m_lockstep.clear();
     emit q->serverClosed();
 }
 
@@ -208,25 +603,46 @@ void ConnectionManagerPrivate::joinGame(QString player, QString ip, QString port
     } else if (m_client) {
         emit q->joiningError(ConnectionManager::ClientAlreadyConnected, "Already connected");
     } else {
-        m_client = new Client(this);
+        if (m_joinedBefore)
+            ++m_statistics.reconnects;
+        m_client = new Client(m_networkThreadEnabled ? 0 : this);
         m_client->setPassword(password);
         m_client->setPlayerName(player);
+        m_client->setOptions(m_options);
         connect(m_client, SIGNAL(joinSuccess(QString)), this, SLOT(handleJoiningSuccess(QString)));
         connect(m_client, SIGNAL(joinError(QString)), this, SLOT(handleJoiningError(QString)));
         connect(m_client, SIGNAL(partSuccess()), this, SLOT(handleLeavingFromServer()));
+        connect(m_client, SIGNAL(connectionLost()), this, SLOT(handleConnectionLost()));
+        connect(m_client, SIGNAL(resumed()), this, SLOT(handleResumed()));
+        connect(m_client, SIGNAL(resumeFailed(QString)), this, SLOT(handleResumeFailed(QString)));
         connect(m_client, SIGNAL(messageRead(QString)), q, SIGNAL(incomingMessage(QString)));
+        connect(m_client, SIGNAL(dataRead(QByteArray)), q, SIGNAL(incomingData(QByteArray)));
+        connect(m_client, SIGNAL(unreliableRead(QByteArray)), q, SIGNAL(incomingUnreliable(QByteArray)));
         connect(m_client, SIGNAL(messageSent()), q, SIGNAL(messageSent()));
         connect(m_client, SIGNAL(messageError()), this, SLOT(handleMessageError()));
         connect(m_client, SIGNAL(pong(int)), q, SIGNAL(pong(int)));
-        m_client->join(ip, port);
+        connect(m_client, SIGNAL(latencyUpdated(QVariantMap)), this, SLOT(handleClientLatencyUpdated(QVariantMap)));
+        connect(m_client, SIGNAL(compressionUpdated(QVariantMap)), this, SLOT(handleClientCompressionUpdated(QVariantMap)));
+        connect(m_client, SIGNAL(congestionChanged(bool)), this, SLOT(handleClientCongestionChanged(bool)));
+        connect(m_client, SIGNAL(statisticsUpdated(NetworkStatistics)),
+                this, SLOT(handleClientStatisticsUpdated(NetworkStatistics)));
+        connect(m_client, SIGNAL(clockUpdated(qint64,qint64)), this, SLOT(handleClockUpdated(qint64,qint64)));
+        connect(m_client, SIGNAL(stateChanged(QString,QVariantMap)), this, SLOT(handleStateChanged(QString,QVariantMap)));
+        connect(m_client, SIGNAL(stateRemoved(QString)), this, SLOT(handleStateRemoved(QString)));
+        connect(m_client, SIGNAL(tickRead(QByteArray)), this, SLOT(handleTickBatch(QByteArray)));
+        connect(m_client, SIGNAL(sendProgress(qint64,qint64)), this, SLOT(handleClientSendProgress(qint64,qint64)));
+        connect(m_client, SIGNAL(receiveProgress(qint64,qint64)), this, SLOT(handleClientReceiveProgress(qint64,qint64)));
+        moveToNetworkThread(m_client);
+        QMetaObject::invokeMethod(m_client, "join", Q_ARG(QString, ip), Q_ARG(QString, port));
     }
 }
 
 void ConnectionManagerPrivate::leaveGame()
 {
     Q_Q(ConnectionManager);
+    m_retryTimer.stop();
     if (m_client) {
-        m_client->close();
+        QMetaObject::invokeMethod(m_client, "close");
     } else {
         emit q->generalError(ConnectionManager::NotConnected, "Cannot leave game, already left");
     }
@@ -238,36 +654,234 @@ void ConnectionManagerPrivate::sendMessage(QString message)
     if (message.isEmpty()) {
         emit q->generalError(ConnectionManager::MessageEmpty, "Cannot send empty message");
     } else if (m_host && m_server) {
-        message.prepend("servermessage ");
-        m_server->sendMessage(message, false);
+        QMetaObject::invokeMethod(m_server, "sendMessage", Q_ARG(QString, message));
+    } else if (!m_host && m_client) {
+        QMetaObject::invokeMethod(m_client, "sendMessage", Q_ARG(QString, message));
+    }
+}
+
+void ConnectionManagerPrivate::sendData(const QByteArray& data)
+{
+    Q_Q(ConnectionManager);
+    if (data.isEmpty()) {
+        emit q->generalError(ConnectionManager::MessageEmpty, "Cannot send empty data");
+    } else if (m_host && m_server) {
+        QMetaObject::invokeMethod(m_server, "sendData", Q_ARG(QByteArray, data));
     } else if (!m_host && m_client) {
-        message.prepend("clientmessage ");
-        m_client->sendMessage(message, false);
+        QMetaObject::invokeMethod(m_client, "sendData", Q_ARG(QByteArray, data));
+    }
+}
+
+void ConnectionManagerPrivate::sendUnreliable(const QByteArray& data)
+{
+    Q_Q(ConnectionManager);
+    if (data.isEmpty()) {
+        emit q->generalError(ConnectionManager::MessageEmpty, "Cannot send empty data");
+    } else if (m_host && m_server) {
+        QMetaObject::invokeMethod(m_server, "sendUnreliable", Q_ARG(QByteArray, data));
+    } else if (!m_host && m_client) {
+        QMetaObject::invokeMethod(m_client, "sendUnreliable", Q_ARG(QByteArray, data));
+    }
+}
+
+void ConnectionManagerPrivate::setState(QString key, QVariantMap fields)
+{
+    Q_Q(ConnectionManager);
+    if (m_client) {
+        emit q->generalError(ConnectionManager::NotHost, "Only the host can change replicated state");
+    } else {
+        m_state[key].setFields(fields);
+    }
+}
+
+void ConnectionManagerPrivate::removeState(QString key)
+{
+    Q_Q(ConnectionManager);
+    if (m_client) {
+        emit q->generalError(ConnectionManager::NotHost, "Only the host can change replicated state");
+    } else {
+        m_state.remove(key);
+    }
+}
+
+void ConnectionManagerPrivate::publishState()
+{
+    Q_Q(ConnectionManager);
+    if (!m_host || !m_server) {
+        emit q->generalError(ConnectionManager::NotHost, "Only a running server can publish state");
+        return;
+    }
+    // zero means no snapshot on the wire
+    if (++m_snapshotId == 0)
+        ++m_snapshotId;
+    // the table is implicitly shared, workers keep copies of it for free
+    QMetaObject::invokeMethod(m_server, "publishSnapshot", Q_ARG(quint32, m_snapshotId), Q_ARG(StateTable, m_state));
+}
+
+void ConnectionManagerPrivate::setTickRate(int ticksPerSecond)
+{
+    m_tickRate = qMax(0, ticksPerSecond);
+    m_lockstep.clear();
+    m_pendingInputs.clear();
+    m_pendingChecksums.clear();
+    m_ticksProduced = 0;
+    m_inputTick = 1;
+    m_stalledTick = 0;
+    if (!m_tickRate) {
+        m_tickTimer.stop();
+        return;
+    }
+    m_lockstep.addPlayer(m_player);
+    foreach (const QString& player, m_players) {
+        m_lockstep.addPlayer(player);
+    }
+    // the timer only wakes us up, the elapsed clock decides how many ticks
+    // are due so late wakeups do not make the tick rate drift
+    m_tickClock.start();
+    m_tickTimer.start(qMax(1, 1000 / m_tickRate));
+}
+
+void ConnectionManagerPrivate::submitInput(const QByteArray& input)
+{
+    m_pendingInputs.append(input);
+}
+
+void ConnectionManagerPrivate::submitChecksum(quint32 tick, quint32 checksum)
+{
+    if (m_host) {
+        reportDesync(tick, m_lockstep.addChecksum(m_player, tick, checksum));
+    } else {
+        m_pendingChecksums.insert(tick, checksum);
+    }
+}
+
+void ConnectionManagerPrivate::handleTick()
+{
+    const qint64 due = m_tickClock.elapsed() * m_tickRate / 1000;
+    while (m_ticksProduced < due) {
+        ++m_ticksProduced;
+        if (m_host && m_server) {
+            m_lockstep.addInput(m_player, m_inputTick, m_pendingInputs);
+        } else if (!m_host && m_client) {
+            QMetaObject::invokeMethod(m_client, "sendInput",
+                                      Q_ARG(QByteArray, LockstepCoordinator::encodeInput(m_inputTick, m_pendingInputs,
+                                                                                         m_pendingChecksums)));
+            m_pendingChecksums.clear();
+        }
+        ++m_inputTick;
+        m_pendingInputs.clear();
     }
+    if (m_host && m_server)
+        releaseTicks();
+}
+
+void ConnectionManagerPrivate::releaseTicks()
+{
+    Q_Q(ConnectionManager);
+    if (!m_tickRate || !m_host || !m_server)
+        return;
+    foreach (const TickBatch& batch, m_lockstep.advance()) {
+        QMetaObject::invokeMethod(m_server, "sendTick", Q_ARG(QByteArray, LockstepCoordinator::encodeBatch(batch)));
+        emitTick(batch);
+    }
+    QStringList waiting = m_lockstep.waitingFor();
+    waiting.removeOne(m_player);
+    // report each stall once
+    if (!waiting.isEmpty() && m_stalledTick != m_lockstep.nextTick()) {
+        m_stalledTick = m_lockstep.nextTick();
+        emit q->tickStalled(int(m_stalledTick), waiting);
+    }
+}
+
+void ConnectionManagerPrivate::emitTick(const TickBatch& batch)
+{
+    Q_Q(ConnectionManager);
+    QVariantMap inputs;
+    for (int i = 0; i < batch.players.size(); ++i) {
+        QVariantList list;
+        foreach (const QByteArray& input, batch.inputs.at(i)) {
+            list.append(input);
+        }
+        inputs.insert(batch.players.at(i), list);
+    }
+    emit q->tickReady(int(batch.tick), inputs, batch.predicted);
+}
+
+void ConnectionManagerPrivate::reportDesync(quint32 tick, const QStringList& players)
+{
+    Q_Q(ConnectionManager);
+    foreach (const QString& player, players) {
+        emit q->desyncDetected(int(tick), player);
+    }
+}
+
+void ConnectionManagerPrivate::handlePlayerInput(QString playerName, QByteArray payload)
+{
+    quint32 tick = 0;
+    QList<QByteArray> inputs;
+    QMap<quint32, quint32> checksums;
+    if (!m_tickRate || !LockstepCoordinator::decodeInput(payload, &tick, &inputs, &checksums))
+        return;
+    QMap<quint32, quint32>::const_iterator it = checksums.constBegin();
+    for (; it != checksums.constEnd(); ++it) {
+        reportDesync(it.key(), m_lockstep.addChecksum(playerName, it.key(), it.value()));
+    }
+    m_lockstep.addInput(playerName, tick, inputs);
+    releaseTicks();
+}
+
+void ConnectionManagerPrivate::handleTickBatch(QByteArray payload)
+{
+    TickBatch batch;
+    if (!m_tickRate || !LockstepCoordinator::decodeBatch(payload, &batch))
+        return;
+    // inputs for ticks that went out without us would only be dropped
+    if (batch.tick >= m_inputTick)
+        m_inputTick = batch.tick + 1;
+    emitTick(batch);
 }
 
 void ConnectionManagerPrivate::ping()
 {
     if (m_host && m_server) {
-        m_server->ping();
+        QMetaObject::invokeMethod(m_server, "ping");
     } else if (!m_host && m_client) {
-        m_client->ping();
+        QMetaObject::invokeMethod(m_client, "ping");
+    }
+}
+
+void ConnectionManagerPrivate::setOptions(const ConnectionOptions& options)
+{
+    m_options = options;
+    if (m_server) {
+        QMetaObject::invokeMethod(m_server, "setOptions", Q_ARG(ConnectionOptions, m_options));
+    }
+    if (m_client) {
+        QMetaObject::invokeMethod(m_client, "setOptions", Q_ARG(ConnectionOptions, m_options));
     }
 }
 
 void ConnectionManagerPrivate::closeConnection()
 {
+    Q_Q(ConnectionManager);
     m_closed = true;
+    m_retryTimer.stop();
     if (m_host && m_server) {
-        m_server->close();
+        QMetaObject::invokeMethod(m_server, "close");
         m_server->deleteLater();
         m_server = 0;
     } else if (!m_host && m_client) {
-        m_client->close();
+        QMetaObject::invokeMethod(m_client, "close");
         m_client->deleteLater();
         m_client = 0;
     }
-    m_session->close();
+    if (m_session && m_session->isOpen()) {
+        m_session->close();
+    } else if (m_multiPlayerModeEnabled) {
+        // enabled without an open session, nothing will report the close
+        m_multiPlayerModeEnabled = false;
+        emit q->multiPlayerModeDisabled();
+    }
 }
 
 
@@ -315,8 +929,260 @@ void ConnectionManager::sendMessage(QString message)
     d->sendMessage(message);
 }
 
+void ConnectionManager::sendData(const QByteArray& data)
+{
+    Q_D(ConnectionManager);
+    d->sendData(data);
+}
+
+void ConnectionManager::sendUnreliable(const QByteArray& data)
+{
+    Q_D(ConnectionManager);
+    d->sendUnreliable(data);
+}
+
+void ConnectionManager::setUnreliableChannelEnabled(bool enabled)
+{
+    Q_D(ConnectionManager);
+    ConnectionOptions options = d->m_options;
+    options.unreliableChannel = enabled;
+    d->setOptions(options);
+}
+
+void ConnectionManager::setState(QString key, QVariantMap fields)
+{
+    Q_D(ConnectionManager);
+    d->setState(key, fields);
+}
+
+void ConnectionManager::removeState(QString key)
+{
+    Q_D(ConnectionManager);
+    d->removeState(key);
+}
+
+void ConnectionManager::publishState()
+{
+    Q_D(ConnectionManager);
+    d->publishState();
+}
+
+void ConnectionManager::setTickRate(int ticksPerSecond)
+{
+    Q_D(ConnectionManager);
+    d->setTickRate(ticksPerSecond);
+}
+
+void ConnectionManager::setPredictionDelay(int ticks)
+{
+    Q_D(ConnectionManager);
+    d->m_lockstep.setPredictionDelay(ticks);
+}
+
+void ConnectionManager::submitInput(const QByteArray& input)
+{
+    Q_D(ConnectionManager);
+    d->submitInput(input);
+}
+
+void ConnectionManager::submitChecksum(int tick, quint32 checksum)
+{
+    Q_D(ConnectionManager);
+    d->submitChecksum(quint32(tick), checksum);
+}
+
 void ConnectionManager::ping()
 {
     Q_D(ConnectionManager);
     d->ping();
 }
+
+void ConnectionManager::setWriteBatching(bool enabled, int windowUsecs)
+{
+    Q_D(ConnectionManager);
+    ConnectionOptions options = d->m_options;
+    options.writeBatching = enabled;
+    options.batchWindowUsecs = windowUsecs;
+    d->setOptions(options);
+}
+
+void ConnectionManager::setCompression(int thresholdBytes, const QByteArray& dictionary)
+{
+    Q_D(ConnectionManager);
+    ConnectionOptions options = d->m_options;
+    options.compressionThreshold = qMax(0, thresholdBytes);
+    options.compressionDictionary = dictionary;
+    d->setOptions(options);
+}
+
+void ConnectionManager::setCongestionControl(int highWaterBytes, int lowWaterBytes, int policy, int timeoutMsecs)
+{
+    Q_D(ConnectionManager);
+    ConnectionOptions options = d->m_options;
+    options.highWaterBytes = qMax(0, highWaterBytes);
+    options.lowWaterBytes = qMax(0, lowWaterBytes);
+    options.congestionPolicy = policy;
+    options.congestionTimeoutMsecs = timeoutMsecs;
+    d->setOptions(options);
+}
+
+void ConnectionManager::setStatisticsLog(QString fileName, int intervalMsecs)
+{
+    Q_D(ConnectionManager);
+    d->setStatisticsLog(fileName, intervalMsecs);
+}
+
+void ConnectionManager::setTracing(int categories)
+{
+    Trace::setCategories(categories);
+}
+
+bool ConnectionManager::writeTrace(QString fileName) const
+{
+    return Trace::writeFile(fileName);
+}
+
+void ConnectionManager::setLowDelay(bool enabled)
+{
+    Q_D(ConnectionManager);
+    ConnectionOptions options = d->m_options;
+    options.lowDelay = enabled;
+    d->setOptions(options);
+}
+
+void ConnectionManager::setNetworkThreadEnabled(bool enabled)
+{
+    Q_D(ConnectionManager);
+    d->setNetworkThreadEnabled(enabled);
+}
+
+void ConnectionManager::startDiscovery()
+{
+    Q_D(ConnectionManager);
+    d->m_discovery.start();
+}
+
+void ConnectionManager::stopDiscovery()
+{
+    Q_D(ConnectionManager);
+    d->m_discovery.stop();
+}
+
+QVariantList ConnectionManager::discoveredServers() const
+{
+    Q_D(const ConnectionManager);
+    return d->m_discovery.servers();
+}
+
+void ConnectionManager::setServerBeaconInterval(int msecs)
+{
+    Q_D(ConnectionManager);
+    ConnectionOptions options = d->m_options;
+    options.beaconIntervalMsecs = qMax(0, msecs);
+    d->setOptions(options);
+}
+
+void ConnectionManager::setResumeTimeout(int msecs)
+{
+    Q_D(ConnectionManager);
+    ConnectionOptions options = d->m_options;
+    options.resumeTimeoutMsecs = qMax(0, msecs);
+    d->setOptions(options);
+}
+
+void ConnectionManager::setHeartbeat(int intervalMsecs, int misses)
+{
+    Q_D(ConnectionManager);
+    ConnectionOptions options = d->m_options;
+    options.heartbeatIntervalMsecs = qMax(0, intervalMsecs);
+    options.heartbeatMisses = qMax(1, misses);
+    d->setOptions(options);
+}
+
+void ConnectionManager::setFastStartEnabled(bool enabled)
+{
+    Q_D(ConnectionManager);
+    d->setFastStartEnabled(enabled);
+}
+
+void ConnectionManager::setServerThreadCount(int count)
+{
+    Q_D(ConnectionManager);
+    d->setServerThreadCount(count);
+}
+
+void ConnectionManager::setPingInterval(int msecs)
+{
+    Q_D(ConnectionManager);
+    ConnectionOptions options = d->m_options;
+    options.pingIntervalMsecs = msecs;
+    d->setOptions(options);
+}
+
+QVariantMap ConnectionManager::latencyStatistics(QString playerName) const
+{
+    Q_D(const ConnectionManager);
+    return d->m_latency.value(playerName);
+}
+
+QVariantMap ConnectionManager::compressionStatistics(QString playerName) const
+{
+    Q_D(const ConnectionManager);
+    return d->m_compression.value(playerName);
+}
+
+QVariantMap ConnectionManager::statistics() const
+{
+    Q_D(const ConnectionManager);
+    return d->totalStatistics().toVariantMap();
+}
+
+QVariantMap ConnectionManager::connectionStatistics(QString playerName) const
+{
+    Q_D(const ConnectionManager);
+    if (!d->m_connectionStatistics.contains(playerName))
+        return QVariantMap();
+    return d->m_connectionStatistics.value(playerName).toVariantMap();
+}
+
+NetworkStatistics ConnectionManager::totalStatistics() const
+{
+    Q_D(const ConnectionManager);
+    return d->totalStatistics();
+}
+
+NetworkStatistics ConnectionManager::playerStatistics(QString playerName) const
+{
+    Q_D(const ConnectionManager);
+    return d->m_connectionStatistics.value(playerName);
+}
+
+qint64 ConnectionManager::serverTime() const
+{
+    Q_D(const ConnectionManager);
+    return (NetworkClock::currentTimeUsecs() + d->m_clockOffset) / 1000;
+}
+
+qint64 ConnectionManager::clockOffsetUsecs() const
+{
+    Q_D(const ConnectionManager);
+    return d->m_clockOffset;
+}
+
+qint64 ConnectionManager::clockUncertaintyUsecs() const
+{
+    Q_D(const ConnectionManager);
+    return d->m_clockUncertainty;
+}
+
+QVariantMap ConnectionManager::state(QString key) const
+{
+    Q_D(const ConnectionManager);
+    return d->m_state.value(key).toMap();
+}
+
+QStringList ConnectionManager::stateKeys() const
+{
+    Q_D(const ConnectionManager);
+    return d->m_state.keys();
+}
@@ -3,14 +3,22 @@
 
 #include <QObject>
 #include "include/connectionmanager.h"
+#include "connectionoptions.h"
+#include "statetable.h"
+#include "lockstep.h"
+#include "serverdiscovery.h"
 
 #include <QNetworkConfigurationManager>
 #include <QNetworkConfiguration>
 #include <QNetworkSession>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QVariantMap>
 
 class Server;
 class Client;
+class QThread;
 
 class ConnectionManagerPrivate : public QObject
 {
@@ -26,7 +34,21 @@ public:
     void joinGame(QString player, QString ip, QString port, QString password);
     void leaveGame();
     void sendMessage(QString message);
+    void sendData(const QByteArray& data);
+    void sendUnreliable(const QByteArray& data);
+    void setState(QString key, QVariantMap fields);
+    void removeState(QString key);
+    void publishState();
+    void setTickRate(int ticksPerSecond);
+    void submitInput(const QByteArray& input);
+    void submitChecksum(quint32 tick, quint32 checksum);
     void ping();
+    void setOptions(const ConnectionOptions& options);
+    void setNetworkThreadEnabled(bool enabled);
+    void setServerThreadCount(int count);
+    void setFastStartEnabled(bool enabled);
+    void setStatisticsLog(QString fileName, int intervalMsecs);
+    NetworkStatistics totalStatistics() const;
     void closeConnection();
 
 public slots:
@@ -38,23 +60,92 @@ public slots:
     void handleJoiningError(QString error);
     void handleJoiningSuccess(QString otherPlayer);
     void handleLeavingFromServer();
+    void handlePlayerMessage(QString playerName, QString message);
+    void handlePlayerData(QString playerName, QByteArray data);
+    void handlePlayerUnreliable(QString playerName, QByteArray data);
     void handleMessageError();
+    void handlePlayerDisconnected(QString playerName);
+    void handleLatencyUpdated(QString playerName, QVariantMap statistics);
+    void handleClientLatencyUpdated(QVariantMap statistics);
+    void handleCompressionUpdated(QString playerName, QVariantMap statistics);
+    void handleClientCompressionUpdated(QVariantMap statistics);
+    void handleCongestionChanged(QString playerName, bool congested);
+    void handleClientCongestionChanged(bool congested);
+    void handleStatisticsUpdated(QString playerName, NetworkStatistics statistics);
+    void handleClientStatisticsUpdated(NetworkStatistics statistics);
+    void writeStatisticsLog();
+    void handleClockUpdated(qint64 offsetUsecs, qint64 uncertaintyUsecs);
+    void handleStateChanged(QString key, QVariantMap fields);
+    void handleStateRemoved(QString key);
+    void handleTick();
+    void handlePlayerConnected(QString playerName);
+    void handlePlayerInput(QString playerName, QByteArray payload);
+    void handleTickBatch(QByteArray payload);
+    void handleClientSendProgress(qint64 bytesSent, qint64 bytesTotal);
+    void handleClientReceiveProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void handleConnectionLost();
+    void handleResumed();
+    void handleResumeFailed(QString error);
+    void retryConnection();
 protected:
     ConnectionManager* const q_ptr;
 private:
+    void moveToNetworkThread(QObject* object);
+    void releaseTicks();
+    void emitTick(const TickBatch& batch);
+    bool isAlreadyOnline();
+    void reportDesync(quint32 tick, const QStringList& players);
+    void scheduleRetry();
+
     QNetworkConfigurationManager m_configManager;
     QNetworkConfiguration m_accessPoint;
     QNetworkSession* m_session;
     QTimer m_networkUpdateTimer;
+    ServerDiscovery m_discovery;
+    // multiplayer mode was enabled from an interface that is already online,
+    // the session is only checked in the background
+    bool m_fastStartEnabled;
+    bool m_fastStarted;
 
     Server* m_server;
     Client* m_client;
+    QString m_otherPlayer;
+    ConnectionOptions m_options;
+    QHash<QString, QVariantMap> m_latency;
+    QHash<QString, QVariantMap> m_compression;
+    NetworkStatistics m_statistics;
+    QHash<QString, NetworkStatistics> m_connectionStatistics;
+    QTimer m_statisticsLogTimer;
+    QString m_statisticsLog;
+    qint64 m_clockOffset;
+    qint64 m_clockUncertainty;
+    bool m_joinedBefore;
+    StateTable m_state;
+    quint32 m_snapshotId;
+    QString m_player;
+    QStringList m_players;
+    LockstepCoordinator m_lockstep;
+    QTimer m_tickTimer;
+    QElapsedTimer m_tickClock;
+    qint64 m_ticksProduced;
+    // tick our next inputs are meant for, a client that fell behind the
+    // host's batches skips ahead
+    quint32 m_inputTick;
+    int m_tickRate;
+    quint32 m_stalledTick;
+    QList<QByteArray> m_pendingInputs;
+    QMap<quint32, quint32> m_pendingChecksums;
 
     bool m_multiPlayerModeEnabled;
     bool m_host;
     int m_retryCount;
     QTimer m_retryTimer;
+    // time since the connection to the server was lost
+    QElapsedTimer m_retryClock;
     bool m_closed;
+    bool m_networkThreadEnabled;
+    QThread* m_networkThread;
+    int m_serverThreadCount;
 };
 
 #endif // CONNECTIONMANAGERPRIVATE_H
@@ -0,0 +1,79 @@
+#ifndef CONNECTIONOPTIONS_H
+#define CONNECTIONOPTIONS_H
+
+#include <QMetaType>
+#include <QByteArray>
+
+// tuning knobs ConnectionManager hands down to every connection it owns
+struct ConnectionOptions
+{
+    // what a connection does while more than highWaterBytes wait to be sent,
+    // values match ConnectionManager::CongestionPolicy
+    enum CongestionPolicy {
+        DropStaleState = 0x01,
+        CoalesceState = 0x02,
+        DisconnectSlowPeer = 0x04
+    };
+
+    ConnectionOptions() :
+        writeBatching(false),
+        batchWindowUsecs(0),
+        lowDelay(false),
+        pingIntervalMsecs(0),
+        unreliableChannel(false),
+        compressionThreshold(0),
+        highWaterBytes(1024 * 1024),
+        lowWaterBytes(256 * 1024),
+        congestionPolicy(CoalesceState),
+        congestionTimeoutMsecs(0),
+        statisticsIntervalMsecs(1000),
+        beaconIntervalMsecs(1000),
+        resumeTimeoutMsecs(10000),
+        heartbeatIntervalMsecs(2000),
+        heartbeatMisses(3)
+    {}
+
+    // collect frames and write them with one call, either at the end of the
+    // current event loop iteration or after batchWindowUsecs
+    bool writeBatching;
+    int batchWindowUsecs;
+    // disables Nagle, trades throughput for latency
+    bool lowDelay;
+    // pings the peer on this interval to keep latency statistics current,
+    // zero pings only on request
+    int pingIntervalMsecs;
+    // pairs every connection with a sequenced UDP channel when both ends want it
+    bool unreliableChannel;
+    // payloads of at least this many bytes are compressed when the peer
+    // can decompress them, zero turns compression off
+    int compressionThreshold;
+    // preset dictionary, has to match on both ends, empty uses the built in one
+    QByteArray compressionDictionary;
+    // a connection counts as congested from highWaterBytes buffered until it
+    // drains to lowWaterBytes, zero high water turns this off and zero low
+    // water means half the high water. A peer that leaves four times the high
+    // water (1 MiB when off) unread on top of the largest transfer is dropped
+    // either way
+    int highWaterBytes;
+    int lowWaterBytes;
+    int congestionPolicy;
+    // with DisconnectSlowPeer, how long a peer may stay congested, zero
+    // gives it a default grace period
+    int congestionTimeoutMsecs;
+    // how often connections report their counters, zero only when they close
+    int statisticsIntervalMsecs;
+    // how often a server announces itself on the LAN, zero keeps it quiet
+    int beaconIntervalMsecs;
+    // how long a dropped client may take to come back and resume its
+    // session, zero ends the game on every drop
+    int resumeTimeoutMsecs;
+    // a peer silent for this long gets a heartbeat, any traffic counts as an
+    // answer so a busy link carries none. Zero turns detection off
+    int heartbeatIntervalMsecs;
+    // unanswered heartbeats after which the peer is taken for dead
+    int heartbeatMisses;
+};
+
+Q_DECLARE_METATYPE(ConnectionOptions)
+
+#endif // CONNECTIONOPTIONS_H
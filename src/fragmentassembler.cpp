@@ -0,0 +1,87 @@
+#include "fragmentassembler.h"
+
+FragmentAssembler::FragmentAssembler() :
+    m_streamedBytes(0),
+    m_error(false)
+{
+}
+
+bool FragmentAssembler::addFragment(const Protocol::Frame& fragment, Protocol::Frame* complete,
+                                    qint64* received, qint64* total)
+{
+    const char* data = fragment.payload.constData();
+    int size = fragment.payload.size();
+
+    quint32 streamId = 0;
+    int length = Protocol::readVarint(data, size, &streamId);
+    if (length <= 0) {
+        m_error = true;
+        return false;
+    }
+    data += length;
+    size -= length;
+
+    if (fragment.opcode == Protocol::FragmentBegin) {
+        Stream stream;
+        stream.opcode = size > 0 ? quint8(*data) : quint8(Protocol::Invalid);
+        // only application payloads are ever large enough to be streamed
+        const quint8 base = stream.opcode & ~Protocol::CompressedFlag;
+        if (m_streams.contains(streamId)
+                || (base != Protocol::Message && base != Protocol::Data && base != Protocol::Snapshot
+                    && base != Protocol::TickBatch && base != Protocol::Input)) {
+            m_error = true;
+            return false;
+        }
+        ++data;
+        --size;
+        length = Protocol::readVarint(data, size, &stream.size);
+        if (length <= 0 || stream.size > Protocol::MaxTransferSize) {
+            m_error = true;
+            return false;
+        }
+        data += length;
+        size -= length;
+        // sizes are the peer's word, memory is only taken as data arrives
+        // and only for as many streams as a well behaved sender opens
+        if (m_streams.size() >= Protocol::MaxOpenStreams
+                || stream.size > Protocol::MaxStreamedBytes - m_streamedBytes) {
+            m_error = true;
+            return false;
+        }
+        m_streamedBytes += stream.size;
+        m_streams.insert(streamId, stream);
+    } else if (!m_streams.contains(streamId)) {
+        m_error = true;
+        return false;
+    }
+
+    Stream& stream = m_streams[streamId];
+    if (quint32(stream.payload.size() + size) > stream.size) {
+        m_error = true;
+        return false;
+    }
+    stream.payload.append(data, size);
+    *received = stream.payload.size();
+    *total = stream.size;
+
+    if (quint32(stream.payload.size()) < stream.size)
+        return false;
+
+    complete->opcode = stream.opcode;
+    complete->payload = stream.payload;
+    m_streamedBytes -= stream.size;
+    m_streams.remove(streamId);
+    return true;
+}
+
+bool FragmentAssembler::hasError() const
+{
+    return m_error;
+}
+
+void FragmentAssembler::clear()
+{
+    m_streams.clear();
+    m_streamedBytes = 0;
+    m_error = false;
+}
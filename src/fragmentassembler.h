@@ -0,0 +1,34 @@
+#ifndef FRAGMENTASSEMBLER_H
+#define FRAGMENTASSEMBLER_H
+
+#include <QHash>
+#include "protocol.h"
+
+// receive side of fragmented payloads, collects FragmentBegin and
+// FragmentData frames of interleaved streams back into whole frames
+class FragmentAssembler
+{
+public:
+    FragmentAssembler();
+    // returns true and fills complete when the fragment finished its stream,
+    // received and total tell how far the stream has got
+    bool addFragment(const Protocol::Frame& fragment, Protocol::Frame* complete,
+                     qint64* received, qint64* total);
+    bool hasError() const;
+    void clear();
+
+private:
+    struct Stream
+    {
+        quint8 opcode;
+        quint32 size;
+        QByteArray payload;
+    };
+
+    QHash<quint32, Stream> m_streams;
+    // declared sizes of the open streams
+    quint32 m_streamedBytes;
+    bool m_error;
+};
+
+#endif // FRAGMENTASSEMBLER_H
@@ -0,0 +1,74 @@
+#include "framedecoder.h"
+#include <QIODevice>
+
+FrameDecoder::FrameDecoder() :
+    m_opcode(Protocol::Invalid),
+    m_payloadSize(0),
+    m_haveHeader(false),
+    m_error(false)
+{
+}
+
+bool FrameDecoder::readFrame(QIODevice* device, Protocol::Frame* frame)
+{
+    if (m_error)
+        return false;
+
+    if (!m_haveHeader) {
+        const QByteArray header = device->peek(Protocol::MaxHeaderSize);
+        if (header.isEmpty())
+            return false;
+
+        const quint8 opcode = quint8(header.at(0));
+        const quint8 base = opcode & ~Protocol::CompressedFlag;
+        if (base == Protocol::Invalid || base >= Protocol::OpcodeCount) {
+            m_error = true;
+            return false;
+        }
+
+        quint32 size = 0;
+        const int length = Protocol::readVarint(header.constData() + 1, header.size() - 1, &size);
+        if (length == 0)
+            return false;
+        if (length < 0 || size > Protocol::MaxPayloadSize) {
+            m_error = true;
+            return false;
+        }
+
+        device->read(1 + length);
+        m_opcode = opcode;
+        m_payloadSize = size;
+        m_haveHeader = true;
+    }
+
+    if (device->bytesAvailable() < m_payloadSize)
+        return false;
+
+    frame->opcode = m_opcode;
+    frame->payload = m_payloadSize ? device->read(m_payloadSize) : QByteArray();
+    m_haveHeader = false;
+    return true;
+}
+
+bool FrameDecoder::hasError() const
+{
+    return m_error;
+}
+
+void FrameDecoder::reset()
+{
+    m_opcode = Protocol::Invalid;
+    m_payloadSize = 0;
+    m_haveHeader = false;
+    m_error = false;
+}
+
+QByteArray FrameDecoder::encodeFrame(quint8 opcode, const QByteArray& payload)
+{
+    QByteArray block;
+    block.reserve(Protocol::MaxHeaderSize + payload.size());
+    block.append(char(opcode));
+    Protocol::writeVarint(&block, payload.size());
+    block.append(payload);
+    return block;
+}
@@ -0,0 +1,32 @@
+#ifndef FRAMEDECODER_H
+#define FRAMEDECODER_H
+
+#include <QByteArray>
+#include "protocol.h"
+
+class QIODevice;
+
+// splits a byte stream into opcode frames, keeps partial header and body
+// state between reads so it can be fed whatever the socket delivered
+class FrameDecoder
+{
+public:
+    FrameDecoder();
+    // takes one complete frame from the device, returns false when more bytes
+    // are needed or the stream is broken, see hasError(). The payload is read
+    // straight from the device into its own buffer, so it can be handed on
+    // without further copies
+    bool readFrame(QIODevice* device, Protocol::Frame* frame);
+    bool hasError() const;
+    void reset();
+
+    static QByteArray encodeFrame(quint8 opcode, const QByteArray& payload = QByteArray());
+
+private:
+    quint8 m_opcode;
+    quint32 m_payloadSize;
+    bool m_haveHeader;
+    bool m_error;
+};
+
+#endif // FRAMEDECODER_H
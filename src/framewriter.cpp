@@ -0,0 +1,441 @@
+#include "framewriter.h"
+#include "framedecoder.h"
+#include "trace.h"
+#include <QTcpSocket>
+#include <QTimer>
+
+// keep this much queued in the socket, enough to fill the pipe but small
+// enough that a control frame goes out after at most a couple of fragments
+static const qint64 FragmentLowWater = 2 * Protocol::FragmentSize;
+
+// a peer that lets this many times the high water mark pile up on top of
+// the largest transfer is dropped whatever the policy, so memory stays
+// bounded without one big payload tripping it on its own
+static const qint64 HardLimitFactor = 4;
+
+// the high water mark assumed for the hard limit when none is set
+static const qint64 DefaultHardLimitWater = 1024 * 1024;
+
+// how long DisconnectSlowPeer waits when no timeout was configured
+static const int DefaultCongestionTimeout = 5000;
+
+// history kept for resumption, a peer that missed more has to join again
+static const int MaxReplayFrames = 512;
+static const qint64 MaxReplayBytes = 1024 * 1024;
+
+static bool isState(quint8 opcode)
+{
+    return (opcode & ~Protocol::CompressedFlag) == Protocol::Snapshot;
+}
+
+FrameWriter::FrameWriter(QTcpSocket* socket, QObject *parent) :
+    QObject(parent),
+    m_socket(socket),
+    m_flushTimer(new QTimer(this)),
+    m_congestionTimer(new QTimer(this)),
+    m_queuedBytes(0),
+    m_hasLatestState(false),
+    m_congested(false),
+    m_stalled(false),
+    m_nextStreamId(1),
+    m_openStreams(0),
+    m_streamedBytes(0),
+    m_fragmentationEnabled(false),
+    m_replayEnabled(false),
+    m_sent(0),
+    m_replayBytes(0)
+{
+    m_flushTimer->setSingleShot(true);
+    m_congestionTimer->setSingleShot(true);
+    connect(m_flushTimer, SIGNAL(timeout()), this, SLOT(flush()));
+    connect(m_congestionTimer, SIGNAL(timeout()), this, SLOT(onCongestionTimeout()));
+    connect(m_socket, SIGNAL(bytesWritten(qint64)), this, SLOT(drainQueues()));
+    connect(m_socket, SIGNAL(connected()), this, SLOT(applySocketOptions()));
+}
+
+void FrameWriter::setOptions(const ConnectionOptions& options)
+{
+    m_options = options;
+    // QTimer counts milliseconds, round the window up so it never collapses
+    // into a zero timeout that flushes every iteration
+    m_flushTimer->setInterval((m_options.batchWindowUsecs + 999) / 1000);
+    if (!m_options.writeBatching)
+        flush();
+    applySocketOptions();
+}
+
+void FrameWriter::applySocketOptions()
+{
+    if (m_socket->state() == QAbstractSocket::ConnectedState)
+        m_socket->setSocketOption(QAbstractSocket::LowDelayOption, m_options.lowDelay ? 1 : 0);
+}
+
+void FrameWriter::setFragmentationEnabled(bool enabled)
+{
+    m_fragmentationEnabled = enabled;
+}
+
+FrameWriter::Priority FrameWriter::priorityOf(quint8 opcode)
+{
+    switch (opcode & ~Protocol::CompressedFlag) {
+    case Protocol::Message:
+    case Protocol::Data:
+        return BulkPriority;
+    case Protocol::Snapshot:
+    case Protocol::Input:
+    case Protocol::TickBatch:
+        return RealtimePriority;
+    default:
+        return ControlPriority;
+    }
+}
+
+void FrameWriter::writeBlock(const QByteArray& block)
+{
+    if (block.isEmpty())
+        return;
+
+    Transfer transfer;
+    transfer.streamId = 0;
+    transfer.opcode = quint8(block.at(0));
+    transfer.offset = 0;
+    transfer.block = block;
+    if (holdState(transfer))
+        return;
+    // realtime frames go out at once unless a realtime stream is still
+    // being sent, they must not overtake it
+    const Priority priority = priorityOf(transfer.opcode);
+    if (priority == BulkPriority || !m_queues[priority].isEmpty()) {
+        enqueue(priority, transfer);
+        return;
+    }
+    write(block);
+    updateCongestion();
+}
+
+void FrameWriter::enqueue(Priority priority, const Transfer& transfer)
+{
+    m_queues[priority].append(transfer);
+    m_queuedBytes += transfer.block.isNull() ? transfer.payload.size() : transfer.block.size();
+    drainQueues();
+}
+
+void FrameWriter::write(const QByteArray& block)
+{
+    ++m_statistics.framesOut;
+    ++m_statistics.framesOutByOpcode[quint8(block.at(0)) & ~Protocol::CompressedFlag];
+    m_statistics.bytesOut += block.size();
+    TRACE(Frames, FrameSent, quint8(block.at(0)), block.size());
+    record(quint8(block.at(0)), QByteArray(), block);
+    if (!m_options.writeBatching) {
+        m_socket->write(block);
+        return;
+    }
+    m_pending.append(block);
+    if (!m_flushTimer->isActive())
+        m_flushTimer->start();
+}
+
+void FrameWriter::flush()
+{
+    m_flushTimer->stop();
+    if (!m_pending.isEmpty()) {
+        m_socket->write(m_pending);
+        m_pending.clear();
+    }
+}
+
+qint64 FrameWriter::bytesPending() const
+{
+    return m_socket->bytesToWrite() + m_pending.size();
+}
+
+qint64 FrameWriter::bytesQueued() const
+{
+    return m_queuedBytes;
+}
+
+bool FrameWriter::isCongested() const
+{
+    return m_congested;
+}
+
+NetworkStatistics FrameWriter::takeStatistics()
+{
+    NetworkStatistics statistics = m_statistics;
+    statistics.sendQueueBytes = bytesPending() + m_queuedBytes;
+    m_statistics = NetworkStatistics();
+    return statistics;
+}
+
+bool FrameWriter::holdState(const Transfer& transfer)
+{
+    if (!m_congested || !isState(transfer.opcode))
+        return false;
+    // deltas are against what the peer acknowledged, so any snapshot it never
+    // saw can be skipped or replaced by a newer one
+    if (m_options.congestionPolicy & ConnectionOptions::CoalesceState) {
+        if (m_hasLatestState)
+            TRACE(Congestion, StaleStateDropped, m_latestState.payload.size(), 0);
+        m_latestState = transfer;
+        m_hasLatestState = true;
+        return true;
+    }
+    if (!(m_options.congestionPolicy & ConnectionOptions::DropStaleState))
+        return false;
+    TRACE(Congestion, StaleStateDropped, transfer.payload.size(), 0);
+    return true;
+}
+
+void FrameWriter::updateCongestion()
+{
+    if (m_stalled)
+        return;
+    const qint64 buffered = bytesPending() + m_queuedBytes;
+    // holds even with congestion tracking turned off
+    const qint64 water = m_options.highWaterBytes > 0 ? m_options.highWaterBytes : DefaultHardLimitWater;
+    if (buffered > HardLimitFactor * water + Protocol::MaxTransferSize) {
+        qDebug("peer is not reading, %lld bytes buffered", buffered);
+        onCongestionTimeout();
+        return;
+    }
+    if (m_options.highWaterBytes <= 0)
+        return;
+    const qint64 lowWater = m_options.lowWaterBytes > 0 ? m_options.lowWaterBytes : m_options.highWaterBytes / 2;
+
+    if (!m_congested && buffered >= m_options.highWaterBytes) {
+        m_congested = true;
+        // state transfers that have not started yet fall under the policy
+        // too, newest first so coalescing keeps the latest one
+        if (m_options.congestionPolicy & (ConnectionOptions::CoalesceState | ConnectionOptions::DropStaleState)) {
+            QList<Transfer>& queue = m_queues[RealtimePriority];
+            for (int i = queue.size() - 1; i >= 0; --i) {
+                if (queue.at(i).offset != 0 || !isState(queue.at(i).opcode))
+                    continue;
+                const Transfer transfer = queue.takeAt(i);
+                m_queuedBytes -= transfer.payload.size();
+                if (!m_hasLatestState)
+                    holdState(transfer);
+            }
+        }
+        if (m_options.congestionPolicy & ConnectionOptions::DisconnectSlowPeer)
+            m_congestionTimer->start(m_options.congestionTimeoutMsecs > 0 ? m_options.congestionTimeoutMsecs
+                                                                          : DefaultCongestionTimeout);
+        TRACE(Congestion, CongestionBegin, buffered, 0);
+        emit congestionChanged(true);
+    } else if (m_congested && buffered <= lowWater) {
+        m_congested = false;
+        m_congestionTimer->stop();
+        TRACE(Congestion, CongestionEnd, buffered, 0);
+        emit congestionChanged(false);
+        if (m_hasLatestState) {
+            m_hasLatestState = false;
+            if (m_latestState.block.isNull()) {
+                enqueue(RealtimePriority, m_latestState);
+            } else {
+                write(m_latestState.block);
+            }
+            m_latestState = Transfer();
+        }
+    }
+}
+
+void FrameWriter::onCongestionTimeout()
+{
+    if (m_stalled)
+        return;
+    m_stalled = true;
+    emit stalled();
+}
+
+bool FrameWriter::needsFragmenting(const QByteArray& payload) const
+{
+    return m_fragmentationEnabled && payload.size() > Protocol::FragmentSize;
+}
+
+void FrameWriter::writeFrame(quint8 opcode, const QByteArray& payload)
+{
+    if (!needsFragmenting(payload)) {
+        writeBlock(FrameDecoder::encodeFrame(opcode, payload));
+        return;
+    }
+
+    Transfer transfer;
+    transfer.streamId = m_nextStreamId++;
+    transfer.opcode = opcode;
+    transfer.payload = payload;
+    transfer.offset = 0;
+    if (!holdState(transfer))
+        enqueue(priorityOf(opcode), transfer);
+}
+
+void FrameWriter::clear()
+{
+    m_flushTimer->stop();
+    m_congestionTimer->stop();
+    m_pending.clear();
+    for (int i = 0; i < PriorityCount; ++i) {
+        m_queues[i].clear();
+    }
+    m_queuedBytes = 0;
+    m_openStreams = 0;
+    m_streamedBytes = 0;
+    m_latestState = Transfer();
+    m_hasLatestState = false;
+    m_congested = false;
+}
+
+bool FrameWriter::canStart(const Transfer& transfer) const
+{
+    if (!transfer.block.isNull() || transfer.offset > 0)
+        return true;
+    return m_openStreams < Protocol::MaxOpenStreams
+            && m_streamedBytes + transfer.payload.size() <= qint64(Protocol::MaxStreamedBytes);
+}
+
+void FrameWriter::drainQueues()
+{
+    while (bytesPending() < FragmentLowWater) {
+        // higher classes first, within a class strictly in order so the
+        // peer gets messages and data as they were sent; only transfers of
+        // different classes interleave. A new stream waits while the peer's
+        // limit is reached, the open ones are heads and keep going
+        QList<Transfer>* queue = 0;
+        for (int i = 0; i < PriorityCount && !queue; ++i) {
+            if (!m_queues[i].isEmpty() && canStart(m_queues[i].first()))
+                queue = &m_queues[i];
+        }
+        if (!queue)
+            break;
+
+        Transfer transfer = queue->takeFirst();
+        if (!transfer.block.isNull()) {
+            m_queuedBytes -= transfer.block.size();
+            write(transfer.block);
+            continue;
+        }
+
+        const int length = qMin(Protocol::FragmentSize, transfer.payload.size() - transfer.offset);
+
+        QByteArray fragment;
+        Protocol::writeVarint(&fragment, transfer.streamId);
+        if (transfer.offset == 0) {
+            fragment.append(char(transfer.opcode));
+            Protocol::writeVarint(&fragment, transfer.payload.size());
+        }
+        fragment.append(transfer.payload.constData() + transfer.offset, length);
+        write(FrameDecoder::encodeFrame(transfer.offset == 0 ? Protocol::FragmentBegin
+                                                             : Protocol::FragmentData, fragment));
+        if (transfer.offset == 0) {
+            ++m_openStreams;
+            m_streamedBytes += transfer.payload.size();
+        }
+        transfer.offset += length;
+        m_queuedBytes -= length;
+        emit sendProgress(transfer.offset, transfer.payload.size());
+
+        if (transfer.offset < transfer.payload.size()) {
+            queue->prepend(transfer);
+        } else {
+            --m_openStreams;
+            m_streamedBytes -= transfer.payload.size();
+            record(transfer.opcode, transfer.payload, QByteArray());
+        }
+    }
+    updateCongestion();
+}
+
+void FrameWriter::setReplayEnabled(bool enabled)
+{
+    m_replayEnabled = enabled;
+}
+
+void FrameWriter::record(quint8 opcode, const QByteArray& payload, const QByteArray& block)
+{
+    // fragments are not frames of their own, the stream counts once it is complete
+    if (!m_replayEnabled || !Protocol::isReplayable(opcode))
+        return;
+    ReplayFrame frame;
+    frame.opcode = opcode;
+    frame.payload = payload;
+    frame.block = block;
+    m_replay.append(frame);
+    m_replayBytes += payload.size() + block.size();
+    ++m_sent;
+    while (m_replay.size() > MaxReplayFrames || (m_replay.size() > 1 && m_replayBytes > MaxReplayBytes)) {
+        const ReplayFrame& oldest = m_replay.first();
+        m_replayBytes -= oldest.payload.size() + oldest.block.size();
+        m_replay.removeFirst();
+    }
+}
+
+ReplayState FrameWriter::takeReplayState()
+{
+    ReplayState state;
+    state.sent = m_sent;
+    state.frames = m_replay;
+    // fragmented payloads start over, the peer drops partial streams
+    for (int i = 0; i < PriorityCount; ++i) {
+        foreach (const Transfer& transfer, m_queues[i]) {
+            if (!Protocol::isReplayable(transfer.opcode))
+                continue;
+            ReplayFrame frame;
+            frame.opcode = transfer.opcode;
+            frame.payload = transfer.payload;
+            frame.block = transfer.block;
+            state.unsent.append(frame);
+        }
+    }
+    clear();
+    m_replay.clear();
+    m_replayBytes = 0;
+    m_sent = 0;
+    return state;
+}
+
+bool FrameWriter::canReplay(const ReplayState& state, quint64 peerReceived)
+{
+    return peerReceived <= state.sent && state.sent - peerReceived <= quint64(state.frames.size());
+}
+
+void FrameWriter::resend(const ReplayFrame& frame)
+{
+    if (frame.block.isNull()) {
+        writeFrame(frame.opcode, frame.payload);
+    } else {
+        writeBlock(frame.block);
+    }
+}
+
+bool FrameWriter::appendUnsent(ReplayState* state, const ReplayFrame& frame)
+{
+    qint64 bytes = frame.payload.size() + frame.block.size();
+    foreach (const ReplayFrame& unsent, state->unsent) {
+        bytes += unsent.payload.size() + unsent.block.size();
+    }
+    if (state->unsent.size() >= MaxReplayFrames || (!state->unsent.isEmpty() && bytes > MaxReplayBytes))
+        return false;
+    state->unsent.append(frame);
+    return true;
+}
+
+void FrameWriter::replay(const ReplayState& state, quint64 peerReceived)
+{
+    if (!canReplay(state, peerReceived))
+        return;
+    // frames the peer has keep their numbers, the rest are numbered again as
+    // they are written
+    const int received = state.frames.size() - int(state.sent - peerReceived);
+    m_replay = state.frames.mid(0, received);
+    m_replayBytes = 0;
+    foreach (const ReplayFrame& frame, m_replay) {
+        m_replayBytes += frame.payload.size() + frame.block.size();
+    }
+    m_sent = peerReceived;
+    for (int i = received; i < state.frames.size(); ++i) {
+        resend(state.frames.at(i));
+    }
+    foreach (const ReplayFrame& frame, state.unsent) {
+        resend(frame);
+    }
+}
@@ -0,0 +1,138 @@
+#ifndef FRAMEWRITER_H
+#define FRAMEWRITER_H
+
+#include <QObject>
+#include <QList>
+#include <QByteArray>
+#include "connectionoptions.h"
+#include "include/networkstatistics.h"
+
+class QTcpSocket;
+class QTimer;
+
+// a replayable frame, encoded when it went out whole
+struct ReplayFrame
+{
+    quint8 opcode;
+    QByteArray payload;
+    QByteArray block;
+};
+
+// what a dropped connection leaves for the one resuming it: the last frames
+// written, the newest of them numbered sent, and those never written
+struct ReplayState
+{
+    ReplayState() : sent(0) {}
+    quint64 sent;
+    QList<ReplayFrame> frames;
+    QList<ReplayFrame> unsent;
+};
+
+// send side of one connection. Frames are classed by opcode: control frames
+// such as pings and acks and realtime ones such as inputs are written at once,
+// bulk messages and data wait in a queue that is written only as the socket
+// drains. Large payloads are cut into fragments, realtime transfers go before
+// bulk ones, so a pong never measures a transfer queued ahead of it. Within a
+// class frames keep their order, only different classes interleave. With
+// batching on, frames are collected and handed to the socket in a single write
+class FrameWriter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FrameWriter(QTcpSocket* socket, QObject *parent = 0);
+    void setOptions(const ConnectionOptions& options);
+    void setFragmentationEnabled(bool enabled);
+    // writes an already encoded frame, or queues it when it is bulk
+    void writeBlock(const QByteArray& block);
+    // encodes and writes a frame, streams the payload when it is large
+    void writeFrame(quint8 opcode, const QByteArray& payload = QByteArray());
+    bool needsFragmenting(const QByteArray& payload) const;
+    void clear();
+    qint64 bytesPending() const;
+    // bulk and fragmented payloads that have not reached the socket yet
+    qint64 bytesQueued() const;
+    bool isCongested() const;
+    // outgoing counters since the last call and the current queue depth
+    NetworkStatistics takeStatistics();
+    // keeps a bounded history of the replayable frames written
+    void setReplayEnabled(bool enabled);
+    // hands over the history and the queued frames and clears the writer
+    ReplayState takeReplayState();
+    // whether the history still holds everything after what the peer received
+    static bool canReplay(const ReplayState& state, quint64 peerReceived);
+    // writes what the peer missed, then what was still queued
+    void replay(const ReplayState& state, quint64 peerReceived);
+    // queues frame behind the unsent ones of a dropped connection, false
+    // when that goes beyond what a resume replays
+    static bool appendUnsent(ReplayState* state, const ReplayFrame& frame);
+
+signals:
+    void sendProgress(qint64 bytesSent, qint64 bytesTotal);
+    void congestionChanged(bool congested);
+    // congested for too long or buffering far beyond the high water mark,
+    // the connection should be dropped
+    void stalled();
+
+public slots:
+    void flush();
+
+private slots:
+    void drainQueues();
+    void applySocketOptions();
+    void onCongestionTimeout();
+
+private:
+    enum Priority {
+        ControlPriority,
+        RealtimePriority,
+        BulkPriority,
+        PriorityCount
+    };
+
+    // a payload being fragmented, or a whole frame when block is set
+    struct Transfer
+    {
+        quint32 streamId;
+        quint8 opcode;
+        QByteArray payload;
+        int offset;
+        QByteArray block;
+    };
+
+    static Priority priorityOf(quint8 opcode);
+    // false for a stream that would go beyond what the peer accepts open
+    bool canStart(const Transfer& transfer) const;
+    void write(const QByteArray& block);
+    void enqueue(Priority priority, const Transfer& transfer);
+    // true when the state frame was dropped or held back by the policy
+    bool holdState(const Transfer& transfer);
+    void updateCongestion();
+    void record(quint8 opcode, const QByteArray& payload, const QByteArray& block);
+    void resend(const ReplayFrame& frame);
+
+    QTcpSocket* m_socket;
+    QTimer* m_flushTimer;
+    QTimer* m_congestionTimer;
+    ConnectionOptions m_options;
+    QByteArray m_pending;
+    QList<Transfer> m_queues[PriorityCount];
+    qint64 m_queuedBytes;
+    NetworkStatistics m_statistics;
+    // newest state frame held back while congested
+    Transfer m_latestState;
+    bool m_hasLatestState;
+    bool m_congested;
+    bool m_stalled;
+    quint32 m_nextStreamId;
+    // fragmented transfers begun and not finished, and their sizes
+    int m_openStreams;
+    qint64 m_streamedBytes;
+    bool m_fragmentationEnabled;
+    bool m_replayEnabled;
+    // replayable frames written so far, the last of m_replay is number m_sent
+    quint64 m_sent;
+    QList<ReplayFrame> m_replay;
+    qint64 m_replayBytes;
+};
+
+#endif // FRAMEWRITER_H
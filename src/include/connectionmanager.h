@@ -2,12 +2,21 @@
 #define CONNECTIONMANAGER_H
 
 #include <QObject>
+#include <QVariantMap>
+#include <QVariantList>
+#include <QStringList>
+#include "networkstatistics.h"
 class ConnectionManagerPrivate;
 
 class ConnectionManager : public QObject
 {
     Q_OBJECT
     Q_DECLARE_PRIVATE(ConnectionManager)
+    // counters of every connection so far, see NetworkStatistics::toVariantMap
+    Q_PROPERTY(QVariantMap statistics READ statistics NOTIFY statisticsChanged)
+    // servers announcing themselves on the LAN while discovery runs, each
+    // with name, ip, port, players, version, compatible and latency in ms
+    Q_PROPERTY(QVariantList discoveredServers READ discoveredServers NOTIFY discoveredServersChanged)
 
     // server related errors
     enum ServerError {
@@ -30,18 +39,77 @@ class ConnectionManager : public QObject
         ServerRefusedConnection,
         ServerNotTrusted,
         AlreadyJoinedInServerMode,
-        ClientGotUnknownError
+        ClientGotUnknownError,
+        // added after the original errors, appended to keep their values
+        ProtocolVersionMismatch,
+        ServerNotResponding,
+        PlayerNameTaken
     };
 
     // message sending related errors
     enum GeneralError {
         NotConnected,
-        MessageEmpty
+        MessageEmpty,
+        NotHost
     };
 
 public:
+    // what a connection does while its peer does not read fast enough, flags
+    enum CongestionPolicy {
+        // state snapshots are not sent until the connection drains
+        DropStaleState = 0x01,
+        // only the newest state snapshot is kept and sent once it drains
+        CoalesceState = 0x02,
+        // the peer is dropped when it stays congested past the timeout
+        DisconnectSlowPeer = 0x04
+    };
+
+    // groups of trace events, flags
+    enum TraceCategory {
+        TraceFrames = 0x01,
+        TraceSessions = 0x02,
+        TraceReplication = 0x04,
+        TraceLockstep = 0x08,
+        TraceCongestion = 0x10,
+        TraceAll = 0xff
+    };
+
     explicit ConnectionManager(QObject *parent = 0);
 
+    // rolling round trip statistics of one connection: samples, min, mean,
+    // p50, p99 and jitter in milliseconds. Clients pass an empty name for the server
+    Q_INVOKABLE QVariantMap latencyStatistics(QString playerName = QString()) const;
+
+    // host's clock in milliseconds since the epoch, estimated from pings on
+    // clients so timestamped inputs can be compared across players
+    Q_INVOKABLE qint64 serverTime() const;
+    // how far the host's clock is ahead of ours and how sure we are about it,
+    // uncertainty is -1 until the first ping has come back
+    Q_INVOKABLE qint64 clockOffsetUsecs() const;
+    Q_INVOKABLE qint64 clockUncertaintyUsecs() const;
+
+    // compression of one connection: raw and compressed bytes per direction,
+    // their ratios and milliseconds spent compressing and decompressing.
+    // Clients pass an empty name for the server
+    Q_INVOKABLE QVariantMap compressionStatistics(QString playerName = QString()) const;
+
+    // traffic counters, in total including connections that have closed and
+    // of one connected player, clients pass an empty name for the server
+    QVariantMap statistics() const;
+    Q_INVOKABLE QVariantMap connectionStatistics(QString playerName = QString()) const;
+    NetworkStatistics totalStatistics() const;
+    NetworkStatistics playerStatistics(QString playerName = QString()) const;
+
+    // writes the recorded trace events of every connection in the Chrome
+    // trace event format, false when the file cannot be written
+    Q_INVOKABLE bool writeTrace(QString fileName) const;
+
+    QVariantList discoveredServers() const;
+
+    // replicated state, the host's own entries or the client's copy of them
+    Q_INVOKABLE QVariantMap state(QString key) const;
+    Q_INVOKABLE QStringList stateKeys() const;
+
 public slots:
     // enabling multiplayer mode, user is going to connect to network
     void enableMultiPlayerMode(bool enable);
@@ -58,12 +126,118 @@ public slots:
     // leaves from current game
     void leaveGame();
 
-    // sends message to other player/chatter
+    // sends message to other players/chatters, server broadcasts to every joined player
     void sendMessage(QString message);
 
+    // sends opaque binary data to other players, no text conversion on the way,
+    // large payloads are streamed in fragments and report progress
+    void sendData(const QByteArray& data);
+
+    // host only, updates fields of a replicated entry, unknown keys and
+    // fields are added. Nothing is sent until publishState
+    void setState(QString key, QVariantMap fields);
+    void removeState(QString key);
+
+    // sends a snapshot of the replicated state to every player, only what
+    // changed since the snapshot each player acknowledged goes on the wire
+    // and players joining later get the whole state right away
+    void publishState();
+
+    // lockstep mode, zero turns it off. Inputs are collected and sent as one
+    // frame per tick, the host releases a tick once every player's inputs for
+    // it have arrived. Host and players have to use the same rate
+    void setTickRate(int ticksPerSecond);
+
+    // host only, ticks to wait for a late player before its previous inputs
+    // are repeated in its place, zero waits forever
+    void setPredictionDelay(int ticks);
+
+    // queues input for the next tick
+    void submitInput(const QByteArray& input);
+
+    // checksum of the simulation state after tick, sent with the next inputs
+    // and compared with the host's to find desyncs
+    void submitChecksum(int tick, quint32 checksum);
+
+    // sends data over the UDP side channel, newer datagrams overtake late ones
+    // and lost ones are not resent, meant for state that is soon outdated.
+    // Dropped while no channel is established
+    void sendUnreliable(const QByteArray& data);
+
+    // pairs connections started after this call with a UDP channel when the
+    // other end enables it too
+    void setUnreliableChannelEnabled(bool enabled);
+
+    // collects outgoing frames and writes them in one go, at the end of the
+    // current event loop iteration or after windowUsecs microseconds
+    void setWriteBatching(bool enabled, int windowUsecs = 0);
+
+    // compresses messages and data of at least thresholdBytes for peers that
+    // can decompress them, zero turns it off. Both ends have to use the same
+    // dictionary, an empty one selects the built in game vocabulary
+    void setCompression(int thresholdBytes, const QByteArray& dictionary = QByteArray());
+
+    // a connection is congested once highWaterBytes wait to be sent and until
+    // it drains to lowWaterBytes, zero low water means half the high water.
+    // policy combines CongestionPolicy flags, a peer buffering four times the
+    // high water mark beyond the largest transfer is dropped whatever the
+    // policy. Zero high water turns this off, the default is 1 MiB high and
+    // 256 KiB low water. A zero timeout for DisconnectSlowPeer means 5 s
+    void setCongestionControl(int highWaterBytes, int lowWaterBytes = 0,
+                              int policy = CoalesceState, int timeoutMsecs = 0);
+
+    // appends the total statistics as one line to fileName every intervalMsecs,
+    // an empty name stops it
+    void setStatisticsLog(QString fileName, int intervalMsecs = 10000);
+
+    // records events of the given TraceCategory flags into an in-memory ring
+    // buffer shared by all managers, zero stops recording. The BATTLEQT_TRACE
+    // environment variable sets the initial flags
+    void setTracing(int categories);
+
+    // toggles TCP_NODELAY, lower latency for realtime games, fewer segments when off
+    void setLowDelay(bool enabled);
+
+    // runs socket I/O, framing and parsing of servers and clients started
+    // after this call on an internal thread, so a busy GUI thread does not
+    // delay reads and pong replies
+    void setNetworkThreadEnabled(bool enabled);
+
+    // listens for server beacons on the LAN, entries expire a few seconds
+    // after their server went quiet
+    void startDiscovery();
+    void stopDiscovery();
+
+    // how often a running server announces itself, zero turns it off
+    void setServerBeaconInterval(int msecs);
+
+    // on by default, enableMultiPlayerMode succeeds at once when an interface
+    // is already online or the last used configuration is still active, the
+    // network session is then opened in the background
+    void setFastStartEnabled(bool enabled);
+
+    // how long a dropped player may reconnect and continue where it left
+    // off, on both ends, zero makes every drop final. Takes effect for
+    // players joining after the call
+    void setResumeTimeout(int msecs);
+
+    // on by default every 2 seconds with 3 misses. A peer that sent nothing
+    // for intervalMsecs is probed, after misses unanswered probes it is
+    // dropped: players leave with playerDisconnected, or after the resume
+    // timeout, and a client reports ServerNotResponding. Zero turns it off,
+    // peers without heartbeat support are never probed
+    void setHeartbeat(int intervalMsecs, int misses = 3);
+
+    // spreads players of servers started after this call over count I/O
+    // threads, zero keeps them on the server's thread, negative uses one per core
+    void setServerThreadCount(int count);
+
     // sends request for response time, emits pong when request received
     void ping();
 
+    // pings automatically on the given interval, zero turns it off
+    void setPingInterval(int msecs);
+
 signals:
     // multiplayer mode (client and server)
     void multiPlayerModeEnabled();
@@ -81,16 +255,57 @@ signals:
     void joiningSucceeded(QString otherPlayer);
     void joiningError(JoiningError error, QString errorString);
     void leftFromGame();
+    // the connection dropped and is being resumed, messages sent meanwhile
+    // fail with an error. joiningError follows when it cannot be resumed
+    void connectionInterrupted();
+    void connectionResumed();
 
     // messages (client and server)
     void messageSent();
     void incomingMessage(QString message);
+    // server only, tells which player sent the message
+    void incomingPlayerMessage(QString playerName, QString message);
+    void incomingData(QByteArray data);
+    // server only, tells which player sent the data
+    void incomingPlayerData(QString playerName, QByteArray data);
+    void incomingUnreliable(QByteArray data);
+    // server only, tells which player sent the datagram
+    void incomingPlayerUnreliable(QString playerName, QByteArray data);
+
+    // client only, fields of a replicated entry that changed with the latest snapshot
+    void stateChanged(QString key, QVariantMap fields);
+    void stateRemoved(QString key);
+
+    // lockstep, inputs maps every player to the list of inputs it submitted
+    // for the tick, predicted players did not make it in time
+    void tickReady(int tick, QVariantMap inputs, QStringList predicted);
+    // host only, the tick waits for these players
+    void tickStalled(int tick, QStringList waitingFor);
+    // host only, the player's simulation differs from the host's at tick
+    void desyncDetected(int tick, QString playerName);
+
+    // the connection to playerName buffers more than the high water mark, and
+    // when it has drained again
+    void congestionStarted(QString playerName);
+    void congestionEnded(QString playerName);
+
+    // connections reported new counters
+    void statisticsChanged();
+
+    // a server appeared, went away or changed its name, players or latency
+    void discoveredServersChanged();
+
+    // progress of large payloads, playerName is the other end of the transfer
+    void dataSendProgress(QString playerName, qint64 bytesSent, qint64 bytesTotal);
+    void dataReceiveProgress(QString playerName, qint64 bytesReceived, qint64 bytesTotal);
 
     // general errors
     void generalError(GeneralError error, QString errorString);
 
     // timing between server and client
     void pong(int msecs);
+    void latencyUpdated(QString playerName, QVariantMap statistics);
+    void clockSynchronized(qint64 offsetUsecs, qint64 uncertaintyUsecs);
 
 protected:
     ConnectionManagerPrivate* const d_ptr;
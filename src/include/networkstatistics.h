@@ -0,0 +1,36 @@
+#ifndef NETWORKSTATISTICS_H
+#define NETWORKSTATISTICS_H
+
+#include <QMap>
+#include <QMetaType>
+#include <QVariantMap>
+
+// counters of one connection or of all of them together
+struct NetworkStatistics
+{
+    NetworkStatistics();
+
+    qint64 bytesIn;
+    qint64 bytesOut;
+    qint64 framesIn;
+    qint64 framesOut;
+    // frame counts by opcode
+    QMap<int, qint64> framesInByOpcode;
+    QMap<int, qint64> framesOutByOpcode;
+    // bytes waiting to be sent at the time of the last update
+    qint64 sendQueueBytes;
+    // time spent decoding and dispatching received frames
+    qint64 parseNsecs;
+    int reconnects;
+    int authFailures;
+
+    bool isEmpty() const;
+    // adds up the counters, the queue depth is taken from other
+    NetworkStatistics& operator+=(const NetworkStatistics& other);
+    // same names as the fields, opcodes by name and parse time in milliseconds
+    QVariantMap toVariantMap() const;
+};
+
+Q_DECLARE_METATYPE(NetworkStatistics)
+
+#endif // NETWORKSTATISTICS_H
@@ -0,0 +1,77 @@
+#include "latencytracker.h"
+#include <QtAlgorithms>
+
+// samples kept for the statistics
+static const int WindowSize = 128;
+
+// pings older than this many sequence numbers are not waited for anymore
+static const quint32 MaxOutstanding = 16;
+
+LatencyTracker::LatencyTracker() :
+    m_nextSequence(1),
+    m_jitter(0)
+{
+    m_clock.start();
+}
+
+quint32 LatencyTracker::startPing()
+{
+    const quint32 sequence = m_nextSequence++;
+    m_pending.insert(sequence, m_clock.nsecsElapsed());
+    m_pending.remove(sequence - MaxOutstanding);
+    return sequence;
+}
+
+qint64 LatencyTracker::finishPing(quint32 sequence)
+{
+    QHash<quint32, qint64>::iterator it = m_pending.find(sequence);
+    if (it == m_pending.end())
+        return -1;
+
+    const qint64 rtt = (m_clock.nsecsElapsed() - it.value()) / 1000;
+    m_pending.erase(it);
+
+    // RFC 3550 style smoothed variation between consecutive samples
+    if (!m_samples.isEmpty()) {
+        const double delta = qAbs(double(rtt - m_samples.last()));
+        m_jitter += (delta - m_jitter) / 16.0;
+    }
+    m_samples.append(rtt);
+    if (m_samples.size() > WindowSize)
+        m_samples.removeFirst();
+    return rtt;
+}
+
+int LatencyTracker::sampleCount() const
+{
+    return m_samples.size();
+}
+
+QVariantMap LatencyTracker::statistics() const
+{
+    QVariantMap statistics;
+    statistics.insert("samples", m_samples.size());
+    if (m_samples.isEmpty())
+        return statistics;
+
+    QList<qint64> sorted = m_samples;
+    qSort(sorted);
+    qint64 sum = 0;
+    foreach (qint64 sample, sorted) {
+        sum += sample;
+    }
+    const int last = sorted.size() - 1;
+    statistics.insert("min", sorted.first() / 1000.0);
+    statistics.insert("mean", sum / 1000.0 / sorted.size());
+    statistics.insert("p50", sorted.at(last / 2) / 1000.0);
+    statistics.insert("p99", sorted.at(last * 99 / 100) / 1000.0);
+    statistics.insert("jitter", m_jitter / 1000.0);
+    return statistics;
+}
+
+void LatencyTracker::clear()
+{
+    m_pending.clear();
+    m_samples.clear();
+    m_jitter = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef LATENCYTRACKER_H
+#define LATENCYTRACKER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QVariantMap>
+
+// matches sequence numbered pings with their pongs on a monotonic clock and
+// keeps a rolling window of round trip times
+class LatencyTracker
+{
+public:
+    LatencyTracker();
+    // returns the sequence number to send with the ping
+    quint32 startPing();
+    // round trip in microseconds, -1 when the sequence is unknown or stale
+    qint64 finishPing(quint32 sequence);
+    int sampleCount() const;
+    // min, mean, p50, p99 and jitter in milliseconds, plus sample count
+    QVariantMap statistics() const;
+    void clear();
+
+private:
+    QElapsedTimer m_clock;
+    QHash<quint32, qint64> m_pending;
+    QList<qint64> m_samples;
+    quint32 m_nextSequence;
+    double m_jitter;
+};
+
+#endif // LATENCYTRACKER_H
@@ -0,0 +1,163 @@
+#include "lockstep.h"
+#include <QDataStream>
+
+// how far back checksums are kept for comparison
+static const quint32 ChecksumWindow = 256;
+
+// how far ahead of the next tick inputs are kept
+static const quint32 InputWindow = 256;
+
+LockstepCoordinator::LockstepCoordinator() :
+    m_nextTick(1),
+    m_predictionDelay(0)
+{
+}
+
+void LockstepCoordinator::setPredictionDelay(int ticks)
+{
+    m_predictionDelay = qMax(0, ticks);
+}
+
+void LockstepCoordinator::addPlayer(QString player)
+{
+    // the first player is the host, its checksums are the reference
+    if (m_players.isEmpty())
+        m_host = player;
+    if (!m_players.contains(player))
+        m_players.insert(player, Player());
+}
+
+void LockstepCoordinator::removePlayer(QString player)
+{
+    m_players.remove(player);
+    // someone has to keep the reference checksums and the tick clock, the
+    // remaining players are ordered by name so every peer picks the same one
+    if (player == m_host)
+        m_host = m_players.isEmpty() ? QString() : m_players.constBegin().key();
+}
+
+void LockstepCoordinator::addInput(QString player, quint32 tick, const QList<QByteArray>& inputs)
+{
+    QMap<QString, Player>::iterator it = m_players.find(player);
+    if (it == m_players.end())
+        return;
+    // a released tick already went out with a guess
+    if (tick < m_nextTick || tick - m_nextTick >= InputWindow || it->inputs.contains(tick))
+        return;
+    it->inputs.insert(tick, inputs);
+}
+
+QStringList LockstepCoordinator::addChecksum(QString player, quint32 tick, quint32 checksum)
+{
+    QStringList mismatched;
+    if (tick + ChecksumWindow < m_nextTick || tick >= m_nextTick)
+        return mismatched;
+
+    QHash<QString, quint32>& checksums = m_checksums[tick];
+    checksums.insert(player, checksum);
+    if (!checksums.contains(m_host))
+        return mismatched;
+
+    const quint32 reference = checksums.value(m_host);
+    QHash<QString, quint32>::const_iterator it = checksums.constBegin();
+    for (; it != checksums.constEnd(); ++it) {
+        // the host's own report is compared against everybody who came first
+        if (it.key() != m_host && (player == m_host || it.key() == player) && it.value() != reference)
+            mismatched.append(it.key());
+    }
+    return mismatched;
+}
+
+QList<TickBatch> LockstepCoordinator::advance()
+{
+    QList<TickBatch> batches;
+    while (!m_players.isEmpty()) {
+        // the host ticks on its own clock, its backlog tells how long the
+        // oldest open tick has been waiting
+        const int waited = m_players.contains(m_host) ? m_players.value(m_host).inputs.size() - 1 : 0;
+        const bool overdue = m_predictionDelay > 0 && waited >= m_predictionDelay;
+        if (!overdue && !waitingFor().isEmpty())
+            break;
+        if (m_players.contains(m_host) && !m_players.value(m_host).inputs.contains(m_nextTick))
+            break;
+
+        TickBatch batch;
+        batch.tick = m_nextTick++;
+        QMap<QString, Player>::iterator it = m_players.begin();
+        for (; it != m_players.end(); ++it) {
+            batch.players.append(it.key());
+            if (!it->inputs.contains(batch.tick)) {
+                batch.predicted.append(it.key());
+            } else {
+                it->last = it->inputs.take(batch.tick);
+            }
+            batch.inputs.append(it->last);
+        }
+        batches.append(batch);
+    }
+
+    while (!m_checksums.isEmpty() && m_checksums.begin().key() + ChecksumWindow < m_nextTick) {
+        m_checksums.erase(m_checksums.begin());
+    }
+    return batches;
+}
+
+quint32 LockstepCoordinator::nextTick() const
+{
+    return m_nextTick;
+}
+
+QStringList LockstepCoordinator::waitingFor() const
+{
+    QStringList players;
+    QMap<QString, Player>::const_iterator it = m_players.constBegin();
+    for (; it != m_players.constEnd(); ++it) {
+        if (!it->inputs.contains(m_nextTick))
+            players.append(it.key());
+    }
+    return players;
+}
+
+void LockstepCoordinator::clear()
+{
+    m_host.clear();
+    m_players.clear();
+    m_checksums.clear();
+    m_nextTick = 1;
+}
+
+QByteArray LockstepCoordinator::encodeInput(quint32 tick, const QList<QByteArray>& inputs,
+                                            const QMap<quint32, quint32>& checksums)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << tick << inputs << checksums;
+    return payload;
+}
+
+bool LockstepCoordinator::decodeInput(const QByteArray& payload, quint32* tick, QList<QByteArray>* inputs,
+                                      QMap<quint32, quint32>* checksums)
+{
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_4_6);
+    in >> *tick >> *inputs >> *checksums;
+    return in.status() == QDataStream::Ok;
+}
+
+QByteArray LockstepCoordinator::encodeBatch(const TickBatch& batch)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << batch.tick << batch.players << batch.inputs << batch.predicted;
+    return payload;
+}
+
+bool LockstepCoordinator::decodeBatch(const QByteArray& payload, TickBatch* batch)
+{
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_4_6);
+    in >> batch->tick >> batch->players >> batch->inputs >> batch->predicted;
+    return in.status() == QDataStream::Ok && batch->players.size() == batch->inputs.size();
+}
@@ -0,0 +1,69 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QStringList>
+
+// everything every player submitted for one simulation tick, players that
+// did not deliver in time got their previous inputs repeated
+struct TickBatch
+{
+    TickBatch() : tick(0) {}
+    quint32 tick;
+    QStringList players;
+    QList<QList<QByteArray> > inputs;
+    QStringList predicted;
+};
+
+// host side of lockstep. Every player contributes one list of inputs per
+// tick, tagged with the tick it is meant for, and a tick is released once
+// all of them have or the late ones have been waited for long enough
+class LockstepCoordinator
+{
+public:
+    LockstepCoordinator();
+    // number of host ticks to wait for a late player before predicting its
+    // inputs, zero waits forever
+    void setPredictionDelay(int ticks);
+    void addPlayer(QString player);
+    // when the host leaves the first remaining player by name takes over
+    void removePlayer(QString player);
+    // inputs for ticks already released or too far ahead are dropped
+    void addInput(QString player, quint32 tick, const QList<QByteArray>& inputs);
+    // returns the players whose checksum of tick differs from the host's
+    QStringList addChecksum(QString player, quint32 tick, quint32 checksum);
+    // releases every tick that is complete or overdue, in order
+    QList<TickBatch> advance();
+    quint32 nextTick() const;
+    // players the next tick still waits for
+    QStringList waitingFor() const;
+    void clear();
+
+    // Input frame: the tick the inputs are meant for, the inputs and
+    // checksums of the ticks the sender simulated since the last one
+    static QByteArray encodeInput(quint32 tick, const QList<QByteArray>& inputs,
+                                  const QMap<quint32, quint32>& checksums);
+    static bool decodeInput(const QByteArray& payload, quint32* tick, QList<QByteArray>* inputs,
+                            QMap<quint32, quint32>* checksums);
+    static QByteArray encodeBatch(const TickBatch& batch);
+    static bool decodeBatch(const QByteArray& payload, TickBatch* batch);
+
+private:
+    struct Player
+    {
+        // inputs by tick, none of them older than the next tick
+        QMap<quint32, QList<QByteArray> > inputs;
+        QList<QByteArray> last;
+    };
+
+    QString m_host;
+    QMap<QString, Player> m_players;
+    QMap<quint32, QHash<QString, quint32> > m_checksums;
+    quint32 m_nextTick;
+    int m_predictionDelay;
+};
+
+#endif // LOCKSTEP_H
@@ -0,0 +1,17 @@
+#include "nameregistry.h"
+#include <QMutexLocker>
+
+bool NameRegistry::claim(const QString& name)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_names.contains(name))
+        return false;
+    m_names.insert(name);
+    return true;
+}
+
+void NameRegistry::release(const QString& name)
+{
+    QMutexLocker locker(&m_mutex);
+    m_names.remove(name);
+}
@@ -0,0 +1,22 @@
+#ifndef NAMEREGISTRY_H
+#define NAMEREGISTRY_H
+
+#include <QSet>
+#include <QString>
+#include <QMutex>
+
+// names of the players in a game, shared by every worker since two sessions
+// with the same name may join on different I/O threads at once
+class NameRegistry
+{
+public:
+    // false when the name is already taken
+    bool claim(const QString& name);
+    void release(const QString& name);
+
+private:
+    QMutex m_mutex;
+    QSet<QString> m_names;
+};
+
+#endif // NAMEREGISTRY_H
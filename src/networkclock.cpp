@@ -0,0 +1,25 @@
+#include "networkclock.h"
+#include <QDateTime>
+#include <QElapsedTimer>
+
+namespace {
+
+struct Anchor
+{
+    Anchor() : epochUsecs(QDateTime::currentMSecsSinceEpoch() * 1000)
+    {
+        timer.start();
+    }
+    qint64 epochUsecs;
+    QElapsedTimer timer;
+};
+
+// set up while the library loads, before any network thread exists
+const Anchor anchor;
+
+}
+
+qint64 NetworkClock::currentTimeUsecs()
+{
+    return anchor.epochUsecs + anchor.timer.nsecsElapsed() / 1000;
+}
@@ -0,0 +1,14 @@
+#ifndef NETWORKCLOCK_H
+#define NETWORKCLOCK_H
+
+#include <QtGlobal>
+
+// wall clock anchored once and advanced by a monotonic timer, so timestamps
+// exchanged with peers are comparable but never jump with clock adjustments
+namespace NetworkClock
+{
+    // microseconds since the epoch
+    qint64 currentTimeUsecs();
+}
+
+#endif // NETWORKCLOCK_H
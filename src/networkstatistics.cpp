@@ -0,0 +1,68 @@
+#include "include/networkstatistics.h"
+#include "protocol.h"
+
+NetworkStatistics::NetworkStatistics() :
+    bytesIn(0),
+    bytesOut(0),
+    framesIn(0),
+    framesOut(0),
+    sendQueueBytes(0),
+    parseNsecs(0),
+    reconnects(0),
+    authFailures(0)
+{
+}
+
+bool NetworkStatistics::isEmpty() const
+{
+    return !bytesIn && !bytesOut && !reconnects && !authFailures;
+}
+
+static void addCounts(QMap<int, qint64>* counts, const QMap<int, qint64>& other)
+{
+    QMap<int, qint64>::const_iterator it = other.constBegin();
+    for (; it != other.constEnd(); ++it) {
+        (*counts)[it.key()] += it.value();
+    }
+}
+
+NetworkStatistics& NetworkStatistics::operator+=(const NetworkStatistics& other)
+{
+    bytesIn += other.bytesIn;
+    bytesOut += other.bytesOut;
+    framesIn += other.framesIn;
+    framesOut += other.framesOut;
+    addCounts(&framesInByOpcode, other.framesInByOpcode);
+    addCounts(&framesOutByOpcode, other.framesOutByOpcode);
+    sendQueueBytes = other.sendQueueBytes;
+    parseNsecs += other.parseNsecs;
+    reconnects += other.reconnects;
+    authFailures += other.authFailures;
+    return *this;
+}
+
+static QVariantMap countsToMap(const QMap<int, qint64>& counts)
+{
+    QVariantMap map;
+    QMap<int, qint64>::const_iterator it = counts.constBegin();
+    for (; it != counts.constEnd(); ++it) {
+        map.insert(Protocol::opcodeName(quint8(it.key())), it.value());
+    }
+    return map;
+}
+
+QVariantMap NetworkStatistics::toVariantMap() const
+{
+    QVariantMap map;
+    map.insert("bytesIn", bytesIn);
+    map.insert("bytesOut", bytesOut);
+    map.insert("framesIn", framesIn);
+    map.insert("framesOut", framesOut);
+    map.insert("framesInByOpcode", countsToMap(framesInByOpcode));
+    map.insert("framesOutByOpcode", countsToMap(framesOutByOpcode));
+    map.insert("sendQueueBytes", sendQueueBytes);
+    map.insert("parseMsecs", parseNsecs / 1000000.0);
+    map.insert("reconnects", reconnects);
+    map.insert("authFailures", authFailures);
+    return map;
+}
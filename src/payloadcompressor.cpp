@@ -0,0 +1,162 @@
+#include "payloadcompressor.h"
+#include "protocol.h"
+#include <QElapsedTimer>
+#include <string.h>
+
+// words game messages keep repeating, zlib favours the end of the dictionary
+// so the most common ones come last
+static const char DefaultDictionary[] =
+    "chat lobby ready start pause resume quit replay version checksum seed "
+    "level map tile grid width height terrain water wall door spawn "
+    "team color name nick rank level experience inventory item weapon ammo "
+    "target attack defend build train research upgrade gather resource gold wood stone food "
+    "unit units player players turn tick frame time score health damage "
+    "id type state action position x y z angle speed velocity direction "
+    "true false null ";
+
+// the declared size is the sender's word, the output buffer starts at a
+// guess and doubles as inflating proves the data is really there
+static const int InitialInflateSize = 64 * 1024;
+
+PayloadCompressor::PayloadCompressor() :
+    m_dictionaryId(0),
+    m_deflateReady(false),
+    m_inflateReady(false),
+    m_rawSent(0),
+    m_compressedSent(0),
+    m_rawReceived(0),
+    m_compressedReceived(0),
+    m_compressNsecs(0),
+    m_decompressNsecs(0)
+{
+    memset(&m_deflate, 0, sizeof(m_deflate));
+    memset(&m_inflate, 0, sizeof(m_inflate));
+    setDictionary(QByteArray());
+}
+
+PayloadCompressor::~PayloadCompressor()
+{
+    if (m_deflateReady)
+        deflateEnd(&m_deflate);
+    if (m_inflateReady)
+        inflateEnd(&m_inflate);
+}
+
+void PayloadCompressor::setDictionary(const QByteArray& dictionary)
+{
+    m_dictionary = dictionary.isEmpty()
+            ? QByteArray::fromRawData(DefaultDictionary, sizeof(DefaultDictionary) - 1)
+            : dictionary;
+    m_dictionaryId = adler32(adler32(0, Z_NULL, 0),
+                             reinterpret_cast<const Bytef*>(m_dictionary.constData()), m_dictionary.size());
+}
+
+// layout: uncompressed size as varint, then a zlib stream
+bool PayloadCompressor::compress(const QByteArray& payload, QByteArray* compressed)
+{
+    QElapsedTimer timer;
+    timer.start();
+    if (!m_deflateReady) {
+        if (deflateInit(&m_deflate, Z_DEFAULT_COMPRESSION) != Z_OK)
+            return false;
+        m_deflateReady = true;
+    } else {
+        deflateReset(&m_deflate);
+    }
+    deflateSetDictionary(&m_deflate, reinterpret_cast<const Bytef*>(m_dictionary.constData()),
+                         m_dictionary.size());
+
+    QByteArray out;
+    Protocol::writeVarint(&out, payload.size());
+    const int header = out.size();
+    out.resize(header + int(deflateBound(&m_deflate, payload.size())));
+
+    m_deflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload.constData()));
+    m_deflate.avail_in = payload.size();
+    m_deflate.next_out = reinterpret_cast<Bytef*>(out.data() + header);
+    m_deflate.avail_out = out.size() - header;
+    const int result = deflate(&m_deflate, Z_FINISH);
+    m_compressNsecs += timer.nsecsElapsed();
+    if (result != Z_STREAM_END)
+        return false;
+
+    out.resize(header + int(m_deflate.total_out));
+    if (out.size() >= payload.size())
+        return false;
+    addSent(payload.size(), out.size());
+    *compressed = out;
+    return true;
+}
+
+bool PayloadCompressor::decompress(const QByteArray& compressed, QByteArray* payload)
+{
+    QElapsedTimer timer;
+    timer.start();
+    quint32 size = 0;
+    const int header = Protocol::readVarint(compressed.constData(), compressed.size(), &size);
+    // refuse to inflate into something no sender could have produced
+    if (header <= 0 || size > Protocol::MaxTransferSize)
+        return false;
+
+    if (!m_inflateReady) {
+        if (inflateInit(&m_inflate) != Z_OK)
+            return false;
+        m_inflateReady = true;
+    } else {
+        inflateReset(&m_inflate);
+    }
+
+    QByteArray out(int(qMin(qint64(size), qMax(qint64(InitialInflateSize), qint64(compressed.size()) * 4))),
+                   Qt::Uninitialized);
+    m_inflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.constData() + header));
+    m_inflate.avail_in = compressed.size() - header;
+    m_inflate.next_out = reinterpret_cast<Bytef*>(out.data());
+    m_inflate.avail_out = out.size();
+    int result = Z_OK;
+    for (;;) {
+        // once the buffer has the declared size the stream has to end in it
+        result = inflate(&m_inflate, out.size() == int(size) ? Z_FINISH : Z_NO_FLUSH);
+        if (result == Z_NEED_DICT) {
+            if (m_inflate.adler != m_dictionaryId)
+                return false; // other end uses another dictionary
+            inflateSetDictionary(&m_inflate, reinterpret_cast<const Bytef*>(m_dictionary.constData()),
+                                 m_dictionary.size());
+            continue;
+        }
+        // done, broken, or out of input with room left
+        if ((result != Z_OK && result != Z_BUF_ERROR) || m_inflate.avail_out > 0 || out.size() == int(size))
+            break;
+        const int used = out.size();
+        out.resize(int(qMin(qint64(size), qint64(used) * 2)));
+        m_inflate.next_out = reinterpret_cast<Bytef*>(out.data() + used);
+        m_inflate.avail_out = out.size() - used;
+    }
+    m_decompressNsecs += timer.nsecsElapsed();
+    if (result != Z_STREAM_END || m_inflate.total_out != size)
+        return false;
+
+    m_rawReceived += size;
+    m_compressedReceived += compressed.size();
+    *payload = out;
+    return true;
+}
+
+void PayloadCompressor::addSent(int payloadSize, int compressedSize)
+{
+    m_rawSent += payloadSize;
+    m_compressedSent += compressedSize;
+}
+
+QVariantMap PayloadCompressor::statistics() const
+{
+    QVariantMap stats;
+    stats.insert("rawBytesSent", m_rawSent);
+    stats.insert("compressedBytesSent", m_compressedSent);
+    stats.insert("sendRatio", m_rawSent ? double(m_compressedSent) / m_rawSent : 1.0);
+    stats.insert("rawBytesReceived", m_rawReceived);
+    stats.insert("compressedBytesReceived", m_compressedReceived);
+    stats.insert("receiveRatio", m_rawReceived ? double(m_compressedReceived) / m_rawReceived : 1.0);
+    stats.insert("compressMsecs", m_compressNsecs / 1000000.0);
+    stats.insert("decompressMsecs", m_decompressNsecs / 1000000.0);
+    return stats;
+}
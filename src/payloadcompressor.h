@@ -0,0 +1,45 @@
+#ifndef PAYLOADCOMPRESSOR_H
+#define PAYLOADCOMPRESSOR_H
+
+#include <QByteArray>
+#include <QVariantMap>
+#include <zlib.h>
+
+// zlib with a preset dictionary, so that even short messages have something
+// to refer back to. One per connection, it also keeps the numbers that tell
+// whether compression pays off
+class PayloadCompressor
+{
+public:
+    PayloadCompressor();
+    ~PayloadCompressor();
+    // both ends have to use the same dictionary, empty selects the built in one
+    void setDictionary(const QByteArray& dictionary);
+    // false when the result would not be smaller than the payload
+    bool compress(const QByteArray& payload, QByteArray* compressed);
+    bool decompress(const QByteArray& compressed, QByteArray* payload);
+    // accounts for a payload another connection compressed for us
+    void addSent(int payloadSize, int compressedSize);
+    // raw and compressed byte counts per direction, their ratios and the
+    // time spent compressing and decompressing in milliseconds
+    QVariantMap statistics() const;
+
+private:
+    PayloadCompressor(const PayloadCompressor&);
+    PayloadCompressor& operator=(const PayloadCompressor&);
+
+    QByteArray m_dictionary;
+    uLong m_dictionaryId;
+    z_stream m_deflate;
+    z_stream m_inflate;
+    bool m_deflateReady;
+    bool m_inflateReady;
+    qint64 m_rawSent;
+    qint64 m_compressedSent;
+    qint64 m_rawReceived;
+    qint64 m_compressedReceived;
+    qint64 m_compressNsecs;
+    qint64 m_decompressNsecs;
+};
+
+#endif // PAYLOADCOMPRESSOR_H
@@ -0,0 +1,334 @@
+#include "protocol.h"
+#include <QDataStream>
+#include <QFile>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <wincrypt.h>
+#endif
+
+QString Protocol::opcodeName(quint8 opcode)
+{
+    static const char* const names[OpcodeCount] = {
+        "invalid", "hello", "reject", "password", "username", "message", "ping", "pong",
+        "data", "fragmentBegin", "fragmentData", "udpOffer", "snapshot", "snapshotAck",
+        "input", "tickBatch", "resumeToken", "resume", "resumed",
+        "heartbeat", "heartbeatAck", "joined"
+    };
+    opcode &= ~CompressedFlag;
+    return opcode < OpcodeCount && names[opcode] ? QString::fromLatin1(names[opcode]) : QString::number(opcode);
+}
+
+void Protocol::writeVarint(QByteArray* out, quint32 value)
+{
+    while (value >= 0x80) {
+        out->append(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out->append(char(value));
+}
+
+int Protocol::readVarint(const char* data, int size, quint32* value)
+{
+    quint32 result = 0;
+    for (int i = 0; i < 5; ++i) {
+        if (i >= size)
+            return 0;
+        const quint8 byte = quint8(data[i]);
+        result |= quint32(byte & 0x7f) << (7 * i);
+        if (!(byte & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+void Protocol::writeVarint64(QByteArray* out, quint64 value)
+{
+    while (value >= 0x80) {
+        out->append(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out->append(char(value));
+}
+
+int Protocol::readVarint64(const char* data, int size, quint64* value)
+{
+    quint64 result = 0;
+    for (int i = 0; i < 10; ++i) {
+        if (i >= size)
+            return 0;
+        const quint8 byte = quint8(data[i]);
+        result |= quint64(byte & 0x7f) << (7 * i);
+        if (!(byte & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+// reads consecutive 64 bit varints, missing trailing ones are zero
+static bool readTimestamps(const char* data, int size, qint64** values, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        quint64 value = 0;
+        if (size > 0) {
+            const int length = Protocol::readVarint64(data, size, &value);
+            if (length <= 0)
+                return false;
+            data += length;
+            size -= length;
+        }
+        *values[i] = qint64(value);
+    }
+    return true;
+}
+
+QByteArray Protocol::encodePing(quint32 sequence, qint64 originate)
+{
+    QByteArray payload;
+    writeVarint(&payload, sequence);
+    writeVarint64(&payload, originate);
+    return payload;
+}
+
+bool Protocol::decodePing(const QByteArray& payload, quint32* sequence, qint64* originate)
+{
+    const int length = readVarint(payload.constData(), payload.size(), sequence);
+    if (length <= 0)
+        return false;
+    qint64* values[] = { originate };
+    return readTimestamps(payload.constData() + length, payload.size() - length, values, 1);
+}
+
+QByteArray Protocol::encodePong(quint32 sequence, qint64 originate, qint64 received, qint64 transmit)
+{
+    QByteArray payload;
+    writeVarint(&payload, sequence);
+    writeVarint64(&payload, originate);
+    writeVarint64(&payload, received);
+    writeVarint64(&payload, transmit);
+    return payload;
+}
+
+bool Protocol::decodePong(const QByteArray& payload, quint32* sequence, qint64* originate,
+                          qint64* received, qint64* transmit)
+{
+    const int length = readVarint(payload.constData(), payload.size(), sequence);
+    if (length <= 0)
+        return false;
+    qint64* values[] = { originate, received, transmit };
+    return readTimestamps(payload.constData() + length, payload.size() - length, values, 3);
+}
+
+QByteArray Protocol::encodeHello(quint8 version, quint32 capabilities)
+{
+    QByteArray payload(1, char(version));
+    writeVarint(&payload, capabilities);
+    return payload;
+}
+
+bool Protocol::decodeHello(const QByteArray& payload, quint8* version, quint32* capabilities)
+{
+    if (payload.isEmpty())
+        return false;
+    *version = quint8(payload.at(0));
+    *capabilities = 0;
+    if (payload.size() > 1 && readVarint(payload.constData() + 1, payload.size() - 1, capabilities) <= 0)
+        return false;
+    return true;
+}
+
+QByteArray Protocol::encodeUdpOffer(quint16 port, quint32 token)
+{
+    QByteArray payload;
+    writeVarint(&payload, port);
+    writeVarint(&payload, token);
+    return payload;
+}
+
+bool Protocol::decodeUdpOffer(const QByteArray& payload, quint16* port, quint32* token)
+{
+    quint32 value = 0;
+    const int length = readVarint(payload.constData(), payload.size(), &value);
+    if (length <= 0 || value == 0 || value > 0xffff)
+        return false;
+    *port = quint16(value);
+    return readVarint(payload.constData() + length, payload.size() - length, token) > 0;
+}
+
+bool Protocol::isReplayable(quint8 opcode)
+{
+    switch (opcode & ~CompressedFlag) {
+    case Message:
+    case Data:
+    case Input:
+    case TickBatch:
+        return true;
+    default:
+        return false;
+    }
+}
+
+QByteArray Protocol::encodeResume(const QByteArray& token, quint64 received)
+{
+    QByteArray payload;
+    writeVarint64(&payload, received);
+    payload.append(token);
+    return payload;
+}
+
+bool Protocol::decodeResume(const QByteArray& payload, QByteArray* token, quint64* received)
+{
+    const int length = readVarint64(payload.constData(), payload.size(), received);
+    if (length <= 0 || length == payload.size())
+        return false;
+    *token = payload.mid(length);
+    return true;
+}
+
+QByteArray Protocol::encodeResumed(quint64 received)
+{
+    QByteArray payload;
+    writeVarint64(&payload, received);
+    return payload;
+}
+
+bool Protocol::decodeResumed(const QByteArray& payload, quint64* received)
+{
+    return readVarint64(payload.constData(), payload.size(), received) > 0;
+}
+
+QByteArray Protocol::encodeSnapshotAck(quint32 id)
+{
+    QByteArray payload;
+    writeVarint(&payload, id);
+    return payload;
+}
+
+bool Protocol::decodeSnapshotAck(const QByteArray& payload, quint32* id)
+{
+    return readVarint(payload.constData(), payload.size(), id) > 0;
+}
+
+static const char BeaconMagic[] = "BQTB";
+static const char ProbeMagic[] = "BQTP";
+static const int MagicSize = 4;
+
+QByteArray Protocol::encodeBeacon(const Beacon& beacon)
+{
+    QByteArray datagram(BeaconMagic, MagicSize);
+    datagram.append(char(beacon.version));
+    writeVarint(&datagram, beacon.port);
+    writeVarint(&datagram, beacon.players);
+    writeVarint64(&datagram, quint64(beacon.echo));
+    datagram.append(beacon.name.toUtf8());
+    return datagram;
+}
+
+bool Protocol::decodeBeacon(const QByteArray& datagram, Beacon* beacon)
+{
+    if (datagram.size() < MagicSize + 1 || !datagram.startsWith(QByteArray(BeaconMagic, MagicSize)))
+        return false;
+    const char* data = datagram.constData() + MagicSize + 1;
+    int size = datagram.size() - MagicSize - 1;
+    beacon->version = quint8(datagram.at(MagicSize));
+
+    quint32 port = 0;
+    int length = readVarint(data, size, &port);
+    if (length <= 0 || port == 0 || port > 0xffff)
+        return false;
+    data += length;
+    size -= length;
+
+    quint32 players = 0;
+    length = readVarint(data, size, &players);
+    if (length <= 0)
+        return false;
+    data += length;
+    size -= length;
+
+    quint64 echo = 0;
+    length = readVarint64(data, size, &echo);
+    if (length <= 0)
+        return false;
+    data += length;
+    size -= length;
+
+    beacon->port = quint16(port);
+    beacon->players = quint16(qMin(players, quint32(0xffff)));
+    beacon->echo = qint64(echo);
+    beacon->name = QString::fromUtf8(data, size);
+    return true;
+}
+
+QByteArray Protocol::encodeProbe(qint64 originate)
+{
+    QByteArray datagram(ProbeMagic, MagicSize);
+    writeVarint64(&datagram, quint64(originate));
+    return datagram;
+}
+
+bool Protocol::decodeProbe(const QByteArray& datagram, qint64* originate)
+{
+    if (!datagram.startsWith(QByteArray(ProbeMagic, MagicSize)))
+        return false;
+    quint64 value = 0;
+    if (readVarint64(datagram.constData() + MagicSize, datagram.size() - MagicSize, &value) <= 0)
+        return false;
+    *originate = qint64(value);
+    return true;
+}
+
+QByteArray Protocol::encodeText(const QString& text, quint32 capabilities)
+{
+    if (capabilities & Utf8Text)
+        return text.toUtf8();
+
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_0);
+    out << text;
+    return payload;
+}
+
+QString Protocol::decodeText(const QByteArray& payload, quint32 capabilities)
+{
+    if (capabilities & Utf8Text)
+        return QString::fromUtf8(payload.constData(), payload.size());
+
+    QString text;
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_4_0);
+    in >> text;
+    return text;
+}
+
+bool Protocol::randomBytes(char* data, int size)
+{
+#ifdef Q_OS_WIN
+    HCRYPTPROV provider = 0;
+    if (!CryptAcquireContext(&provider, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT))
+        return false;
+    const bool ok = CryptGenRandom(provider, DWORD(size), reinterpret_cast<BYTE*>(data));
+    CryptReleaseContext(provider, 0);
+    return ok;
+#else
+    QFile random("/dev/urandom");
+    if (!random.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        return false;
+    return random.read(data, size) == size;
+#endif
+}
+
+bool Protocol::equalTokens(const QByteArray& a, const QByteArray& b)
+{
+    if (a.size() != b.size())
+        return false;
+    uchar difference = 0;
+    for (int i = 0; i < a.size(); ++i) {
+        difference |= uchar(a.at(i)) ^ uchar(b.at(i));
+    }
+    return difference == 0;
+}
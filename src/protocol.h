@@ -0,0 +1,163 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <QByteArray>
+#include <QString>
+
+// wire format: one opcode byte, payload length as varint, payload
+namespace Protocol
+{
+    // bumped whenever the wire format changes, exchanged in Hello
+    const quint8 Version = 1;
+    const quint8 MinimumVersion = 1;
+
+    // guards against garbage lengths, nothing legitimate comes close
+    const quint32 MaxPayloadSize = 16 * 1024 * 1024;
+
+    // longest header: opcode and five varint bytes
+    const int MaxHeaderSize = 6;
+
+    // payloads above this are streamed as fragments so that small frames can
+    // be interleaved with them
+    const int FragmentSize = 16 * 1024;
+
+    // upper bound for a reassembled payload
+    const quint32 MaxTransferSize = 64 * 1024 * 1024;
+
+    // fragmented payloads in flight per direction and the sum of their
+    // sizes, a sender starts no stream beyond them and a receiver drops a
+    // peer that does
+    const int MaxOpenStreams = 8;
+    const quint32 MaxStreamedBytes = 2 * MaxTransferSize;
+
+    // zero is never a valid opcode, legacy peers start every frame with the
+    // high byte of a quint16 length which is zero for all short messages
+    enum Opcode {
+        Invalid = 0x00,
+        Hello = 0x01,
+        Reject = 0x02,
+        Password = 0x03,
+        Username = 0x04,
+        Message = 0x05,
+        Ping = 0x06,
+        Pong = 0x07,
+        Data = 0x08,
+        FragmentBegin = 0x09,
+        FragmentData = 0x0a,
+        UdpOffer = 0x0b,
+        Snapshot = 0x0c,
+        SnapshotAck = 0x0d,
+        Input = 0x0e,
+        TickBatch = 0x0f,
+        ResumeToken = 0x10,
+        Resume = 0x11,
+        Resumed = 0x12,
+        Heartbeat = 0x13,
+        HeartbeatAck = 0x14,
+        Joined = 0x15,
+        OpcodeCount
+    };
+
+    // set on the opcode byte when the payload went through PayloadCompressor
+    const quint8 CompressedFlag = 0x80;
+
+    // optional features, offered by the client in Hello and confirmed by the
+    // server, a peer that sends no capabilities gets the legacy behaviour
+    enum Capability {
+        Utf8Text = 0x01,
+        Fragments = 0x02,
+        // only offered when the application asked for it
+        Unreliable = 0x04,
+        // the peer can decompress, whether anything gets compressed is up to the sender
+        Compression = 0x08,
+        // a dropped connection can be resumed, only offered when enabled
+        Resumable = 0x10,
+        // the peer answers heartbeats, so its silence can be taken for a dead link
+        KeepAlive = 0x20,
+        // the server confirms the player name with Joined or rejects it as
+        // taken, the client waits for that before it reports the join
+        NameCheck = 0x40
+    };
+    const quint32 SupportedCapabilities = Utf8Text | Fragments | Compression | KeepAlive | NameCheck;
+
+    // LAN discovery, servers broadcast beacons to this port and answer
+    // probes from listeners with a beacon echoing the probe's timestamp
+    const quint16 DiscoveryPort = 47611;
+
+    struct Beacon
+    {
+        Beacon() : version(0), port(0), players(0), echo(0) {}
+        quint8 version;
+        // TCP port to join on, the address is where the beacon came from
+        quint16 port;
+        quint16 players;
+        // originate timestamp of the probe being answered, zero for periodic beacons
+        qint64 echo;
+        QString name;
+    };
+
+    struct Frame
+    {
+        Frame() : opcode(Invalid) {}
+        quint8 opcode;
+        QByteArray payload;
+    };
+
+    // readable name for statistics and logs, compressed frames count as their opcode
+    QString opcodeName(quint8 opcode);
+
+    void writeVarint(QByteArray* out, quint32 value);
+    // returns number of bytes consumed, zero when incomplete and -1 when malformed
+    int readVarint(const char* data, int size, quint32* value);
+    void writeVarint64(QByteArray* out, quint64 value);
+    int readVarint64(const char* data, int size, quint64* value);
+
+    QByteArray encodeHello(quint8 version, quint32 capabilities);
+    bool decodeHello(const QByteArray& payload, quint8* version, quint32* capabilities);
+
+    // pings carry a sequence number and the sender's clock, pongs echo both
+    // and add when the ping arrived and when the pong left, NTP style. Peers
+    // that send only the sequence get zero timestamps
+    QByteArray encodePing(quint32 sequence, qint64 originate);
+    bool decodePing(const QByteArray& payload, quint32* sequence, qint64* originate);
+    QByteArray encodePong(quint32 sequence, qint64 originate, qint64 received, qint64 transmit);
+    bool decodePong(const QByteArray& payload, quint32* sequence, qint64* originate,
+                    qint64* received, qint64* transmit);
+
+    // port of the server's UDP socket for this session and the token every
+    // datagram has to carry
+    QByteArray encodeUdpOffer(quint16 port, quint32 token);
+    bool decodeUdpOffer(const QByteArray& payload, quint16* port, quint32* token);
+
+    // frames that are counted and replayed when a session resumes, state
+    // snapshots are not, a resumed client gets a full one instead
+    bool isReplayable(quint8 opcode);
+
+    // a reconnecting client sends its token and how many replayable frames
+    // it received, the server answers with its own count
+    QByteArray encodeResume(const QByteArray& token, quint64 received);
+    bool decodeResume(const QByteArray& payload, QByteArray* token, quint64* received);
+    QByteArray encodeResumed(quint64 received);
+    bool decodeResumed(const QByteArray& payload, quint64* received);
+
+    QByteArray encodeSnapshotAck(quint32 id);
+    bool decodeSnapshotAck(const QByteArray& payload, quint32* id);
+
+    // discovery datagrams, not framed, start with a four byte magic
+    QByteArray encodeBeacon(const Beacon& beacon);
+    bool decodeBeacon(const QByteArray& datagram, Beacon* beacon);
+    QByteArray encodeProbe(qint64 originate);
+    bool decodeProbe(const QByteArray& datagram, qint64* originate);
+
+    // UTF-8 when negotiated, QDataStream UTF-16 for legacy peers
+    QByteArray encodeText(const QString& text, quint32 capabilities);
+    QString decodeText(const QByteArray& payload, quint32 capabilities);
+
+    // fills data from the system's cryptographic generator, for tokens a
+    // stranger must not guess. False when it is not available
+    bool randomBytes(char* data, int size);
+    // compares secrets in a time that does not tell how much of a guess matched
+    bool equalTokens(const QByteArray& a, const QByteArray& b);
+}
+
+#endif // PROTOCOL_H
@@ -0,0 +1,36 @@
+#include "resumeregistry.h"
+#include "protocol.h"
+#include <QMutexLocker>
+
+void ResumeRegistry::store(const ResumeState& state)
+{
+    QMutexLocker locker(&m_mutex);
+    m_states.append(state);
+}
+
+bool ResumeRegistry::take(const QByteArray& token, ResumeState* state)
+{
+    QMutexLocker locker(&m_mutex);
+    for (int i = 0; i < m_states.size(); ++i) {
+        if (Protocol::equalTokens(m_states.at(i).token, token)) {
+            *state = m_states.takeAt(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ResumeRegistry::append(const QByteArray& token, const ReplayFrame& frame)
+{
+    QMutexLocker locker(&m_mutex);
+    for (int i = 0; i < m_states.size(); ++i) {
+        if (!Protocol::equalTokens(m_states.at(i).token, token))
+            continue;
+        if (FrameWriter::appendUnsent(&m_states[i].replay, frame))
+            return true;
+        m_states.removeAt(i);
+        return false;
+    }
+    // already resumed or expired
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef RESUMEREGISTRY_H
+#define RESUMEREGISTRY_H
+
+#include <QList>
+#include <QMutex>
+#include "framewriter.h"
+
+// everything a session needs to pick up where a dropped one left off
+struct ResumeState
+{
+    ResumeState() : capabilities(0), received(0) {}
+    QByteArray token;
+    QString playerName;
+    quint32 capabilities;
+    // replayable frames received from the client
+    quint64 received;
+    ReplayState replay;
+};
+
+// sessions waiting for their client to come back, shared by every worker
+// since the new connection may land on another I/O thread
+class ResumeRegistry
+{
+public:
+    void store(const ResumeState& state);
+    // removes and returns the state, false when it is unknown or was taken
+    bool take(const QByteArray& token, ResumeState* state);
+    // adds a frame sent while the client was away to what it gets on
+    // resuming. False when there is more than it can get, the state is
+    // dropped then
+    bool append(const QByteArray& token, const ReplayFrame& frame);
+
+private:
+    QMutex m_mutex;
+    // searched with a constant time compare, a hash lookup would tell how
+    // close a guessed token came
+    QList<ResumeState> m_states;
+};
+
+#endif // RESUMEREGISTRY_H
@@ -1,23 +1,27 @@
 #include "server.h"
-#include <QTcpServer>
-#include <QTcpSocket>
+#include "serverlistener.h"
+#include "serverworker.h"
+#include "serverbeacon.h"
+#include <QThread>
 #include <QHostAddress>
 #include <QNetworkInterface>
-#include <QStringList>
 
 Server::Server(QObject *parent) :
     QObject(parent),
     m_server(NULL),
-    m_client(NULL),
-    m_pingTime(NULL),
-    blockSize(0),
-    m_authenticated(false),
-    m_created(false),
-    m_closed(false),
-    m_otherPlayerConnected(false)
+    m_beacon(NULL),
+    m_threadCount(0),
+    m_nextWorker(0),
+    m_players(0),
+    m_created(false)
 {
 }
 
+Server::~Server()
+{
+    stopWorkers();
+}
+
 void Server::setPassword(QString password)
 {
     m_password = password;
@@ -28,15 +32,34 @@ void Server::setPlayerName(QString playerName)
     m_player = playerName;
 }
 
+void Server::setThreadCount(int count)
+{
+    m_threadCount = count;
+}
+
+int Server::playerCount() const
+{
+    return m_players;
+}
+
+void Server::setOptions(const ConnectionOptions& options)
+{
+    m_options = options;
+    if (m_beacon)
+        m_beacon->setInterval(m_options.beaconIntervalMsecs);
+    foreach (ServerWorker* worker, m_workers) {
+        QMetaObject::invokeMethod(worker, "setOptions", Q_ARG(ConnectionOptions, m_options));
+    }
+}
+
 void Server::create()
 {
     if (m_created && m_server) {
         emit createFailure("exists");
         return;
     }
-    m_closed = false;
-    m_server = new QTcpServer(this);
-    connect(m_server, SIGNAL(newConnection()), this, SLOT(connectPlayer()));
+    m_server = new ServerListener(this);
+    connect(m_server, SIGNAL(connectionAccepted(int)), this, SLOT(dispatchConnection(int)));
     if (!m_server->listen()) {
         qDebug("could not start server, reason: %s", qPrintable(m_server->errorString()));
         m_server->deleteLater();
@@ -60,154 +83,188 @@ void Server::create()
         m_ip = ipAddress;
         m_port = QString::number(m_server->serverPort());
         m_created = true;
+        startWorkers();
+        if (!m_beacon)
+            m_beacon = new ServerBeacon(this);
+        m_beacon->setName(m_player);
+        m_beacon->setPlayerCount(m_players);
+        if (!m_beacon->start(m_server->serverPort(), m_options.beaconIntervalMsecs))
+            qDebug("could not bind beacon socket, server is not announced on the LAN");
         emit createSuccess(m_ip, m_port);
     }
 }
 
-void Server::connectPlayer()
+void Server::startWorkers()
 {
-    if (m_client) {
-        m_client->deleteLater();
-        m_client = 0;
+    if (!m_workers.isEmpty())
+        return;
+
+    if (m_threadCount <= 0) {
+        ServerWorker* worker = new ServerWorker(this);
+        worker->setPassword(m_password);
+        worker->setPlayerName(m_player);
+        worker->setOptions(m_options);
+        worker->setResumeRegistry(&m_resumes);
+        worker->setNameRegistry(&m_names);
+        m_workers.append(worker);
+    } else {
+        for (int i = 0; i < m_threadCount; ++i) {
+            QThread* thread = new QThread(this);
+            ServerWorker* worker = new ServerWorker;
+            worker->setPassword(m_password);
+            worker->setPlayerName(m_player);
+            worker->setOptions(m_options);
+            worker->setResumeRegistry(&m_resumes);
+            worker->setNameRegistry(&m_names);
+            worker->moveToThread(thread);
+            thread->start();
+            m_threads.append(thread);
+            m_workers.append(worker);
+        }
+    }
+
+    foreach (ServerWorker* worker, m_workers) {
+        connect(worker, SIGNAL(playerConnected(QString)), this, SLOT(onPlayerConnected(QString)));
+        connect(worker, SIGNAL(playerDisconnected(QString)), this, SLOT(onPlayerDisconnected(QString)));
+        connect(worker, SIGNAL(messageRead(QString,QString)), this, SIGNAL(messageRead(QString,QString)));
+        connect(worker, SIGNAL(dataRead(QString,QByteArray)), this, SIGNAL(dataRead(QString,QByteArray)));
+        connect(worker, SIGNAL(unreliableRead(QString,QByteArray)),
+                this, SIGNAL(unreliableRead(QString,QByteArray)));
+        connect(worker, SIGNAL(inputRead(QString,QByteArray)), this, SIGNAL(inputRead(QString,QByteArray)));
+        connect(worker, SIGNAL(pong(int)), this, SIGNAL(pong(int)));
+        connect(worker, SIGNAL(latencyUpdated(QString,QVariantMap)),
+                this, SIGNAL(latencyUpdated(QString,QVariantMap)));
+        connect(worker, SIGNAL(compressionUpdated(QString,QVariantMap)),
+                this, SIGNAL(compressionUpdated(QString,QVariantMap)));
+        connect(worker, SIGNAL(congestionChanged(QString,bool)), this, SIGNAL(congestionChanged(QString,bool)));
+        connect(worker, SIGNAL(statisticsUpdated(QString,NetworkStatistics)),
+                this, SIGNAL(statisticsUpdated(QString,NetworkStatistics)));
+        connect(worker, SIGNAL(sendProgress(QString,qint64,qint64)),
+                this, SIGNAL(sendProgress(QString,qint64,qint64)));
+        connect(worker, SIGNAL(receiveProgress(QString,qint64,qint64)),
+                this, SIGNAL(receiveProgress(QString,qint64,qint64)));
     }
-    m_client = m_server->nextPendingConnection();
-    connect(m_client, SIGNAL(readyRead()), this, SLOT(readMessage()));
-    connect(m_client, SIGNAL(disconnected()),
-            this, SLOT(onDisconnected()));
 }
 
-void Server::onDisconnected()
+void Server::stopWorkers()
 {
-    qDebug("client disconnected on server side");
-    m_client->deleteLater();
-    m_client = 0;
-    m_authenticated = false;
-    if (m_closed) {
-        m_server->close();
-        m_server->deleteLater();
-        m_server = 0;
-        m_closed = false;
+    // threaded workers have no parent, their deferred deletes run when the
+    // thread finishes
+    if (!m_threads.isEmpty()) {
+        foreach (ServerWorker* worker, m_workers) {
+            worker->deleteLater();
+        }
+        foreach (QThread* thread, m_threads) {
+            thread->quit();
+            thread->wait();
+        }
+        qDeleteAll(m_threads);
+        m_threads.clear();
     }
-    m_otherPlayerConnected = false;
-    emit playerDisconnected(m_player);
+    m_workers.clear();
 }
 
-void Server::readMessage()
+void Server::dispatchConnection(int socketDescriptor)
 {
-    QDataStream in(m_client);
-    in.setVersion(QDataStream::Qt_4_0);
-
-    if (blockSize == 0) {
-        if (m_client->bytesAvailable() < (int)sizeof(quint16))
-            return;
-
-        in >> blockSize;
+    // least loaded worker wins, ties go round robin. The connection counts
+    // right away, a burst of accepts would otherwise all see the loads from
+    // before the first one reached its worker
+    ServerWorker* target = 0;
+    int targetLoad = 0;
+    for (int i = 0; i < m_workers.size(); ++i) {
+        ServerWorker* worker = m_workers.at((m_nextWorker + i) % m_workers.size());
+        const int load = worker->load();
+        if (!target || load < targetLoad) {
+            target = worker;
+            targetLoad = load;
+        }
     }
+    m_nextWorker = (m_workers.indexOf(target) + 1) % m_workers.size();
+    target->reserveConnection();
+    QMetaObject::invokeMethod(target, "addConnection", Q_ARG(int, socketDescriptor));
+}
 
-    if (m_client->bytesAvailable() < blockSize)
-        return;
+void Server::onPlayerConnected(QString playerName)
+{
+    ++m_players;
+    if (m_beacon)
+        m_beacon->setPlayerCount(m_players);
+    emit playerConnected(playerName);
+}
 
-    QString message;
-    in >> message;
-    blockSize = 0;
-    parseMessage(message);
+void Server::onPlayerDisconnected(QString playerName)
+{
+    --m_players;
+    if (m_beacon)
+        m_beacon->setPlayerCount(m_players);
+    emit playerDisconnected(playerName);
 }
 
-void Server::parseMessage(QString message)
+void Server::sendMessage(QString message)
 {
-    qDebug("parsing message from client: %s", qPrintable(message));
-    QStringList list = message.split(" ");
-    QString command = list.first();
-    if (!m_authenticated && command != "password") {
-        onAuthFail();
-        return;
-    } else if (m_authenticated && command == "password") {
+    if (!m_players) {
+        emit messageError();
         return;
     }
+    // every worker shares the same implicitly shared string
+    foreach (ServerWorker* worker, m_workers) {
+        QMetaObject::invokeMethod(worker, "sendMessage", Q_ARG(QString, message));
+    }
+    emit messageSent();
+}
 
-    if (command == "password") {
-        if ((list.size() == 2 && !m_password.isEmpty() && list.at(1) == m_password)
-                || (list.size() == 1 && m_password.isEmpty())) {
-            onAuthSuccess();
-        } else {
-            onAuthFail();
-        }
+void Server::sendData(const QByteArray& data)
+{
+    if (!m_players) {
+        emit messageError();
         return;
     }
-
-    if (m_authenticated) {
-        if (command == "username") {
-            if (list.size() == 2) {
-                m_otherPlayerName = list.at(1);
-                qDebug("user %s joined server", qPrintable(m_otherPlayerName));
-                m_otherPlayerConnected = true;
-                emit playerConnected(m_otherPlayerName);
-            } else {
-                return;
-            }
-        } else if (command == "clientmessage") {
-            qDebug("got client message: %s", qPrintable(message));
-            message.remove(0, 14);
-            emit messageRead(message);
-        } else if (command == "ping") {
-            sendMessage("pong", true);
-        } else if (command == "pong") {
-            if (m_pingTime) {
-                emit pong(m_pingTime->elapsed());
-                delete m_pingTime;
-                m_pingTime = 0;
-            } else {
-                emit pong(-1);
-            }
-        }
-        // discard message if none of those
+    foreach (ServerWorker* worker, m_workers) {
+        QMetaObject::invokeMethod(worker, "sendData", Q_ARG(QByteArray, data));
     }
+    emit messageSent();
 }
 
-void Server::onAuthSuccess()
+void Server::sendUnreliable(const QByteArray& data)
 {
-    qDebug("client successfully authenticated, sending username");
-    m_authenticated = true;
-    sendMessage("username " + m_player, true);
+    // fire and forget, no delivery to report either way
+    foreach (ServerWorker* worker, m_workers) {
+        QMetaObject::invokeMethod(worker, "sendUnreliable", Q_ARG(QByteArray, data));
+    }
 }
 
-void Server::onAuthFail()
+void Server::publishSnapshot(quint32 id, const StateTable& state)
 {
-    qDebug("authentication failure, disconnecting");
-    m_client->disconnectFromHost();
+    foreach (ServerWorker* worker, m_workers) {
+        QMetaObject::invokeMethod(worker, "publishSnapshot", Q_ARG(quint32, id), Q_ARG(StateTable, state));
+    }
 }
 
-void Server::sendMessage(QString message, bool internal)
+void Server::sendTick(const QByteArray& payload)
 {
-    QByteArray block;
-    QDataStream out(&block, QIODevice::WriteOnly);
-    out.setVersion(QDataStream::Qt_4_0);
-    out << (quint16)0;
-    out << message;
-    out.device()->seek(0);
-    out << (quint16)(block.size() - sizeof(quint16));
-    qDebug("server sending message: %s", qPrintable(QString(block)));
-    if ((m_otherPlayerConnected && m_client) || internal) {
-        m_client->write(block);
-        if (!internal) {
-            emit messageSent();
-        }
-    } else if (!m_otherPlayerConnected || m_client) {
-        emit messageError();
+    foreach (ServerWorker* worker, m_workers) {
+        QMetaObject::invokeMethod(worker, "sendTick", Q_ARG(QByteArray, payload));
     }
 }
 
 void Server::ping()
 {
-    m_pingTime = new QTime;
-    m_pingTime->start();
-    sendMessage("ping", true);
+    foreach (ServerWorker* worker, m_workers) {
+        QMetaObject::invokeMethod(worker, "ping");
+    }
 }
 
 void Server::close()
 {
-    if (m_server && m_client) {
-        m_closed = true;
-        m_client->disconnectFromHost();
+    if (m_server) {
+        m_server->close();
+        m_server->deleteLater();
+        m_server = 0;
+        m_created = false;
+    }
+    if (m_beacon)
+        m_beacon->stop();
+    foreach (ServerWorker* worker, m_workers) {
+        QMetaObject::invokeMethod(worker, "close");
     }
 }
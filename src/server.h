@@ -2,20 +2,43 @@
 #define SERVER_H
 
 #include <QObject>
-#include <QTime>
+#include <QList>
+#include <QVariantMap>
+#include "connectionoptions.h"
+#include "statetable.h"
+#include "resumeregistry.h"
+#include "nameregistry.h"
+#include "include/networkstatistics.h"
 
-class QTcpServer;
-class QTcpSocket;
+class QThread;
+class ServerListener;
+class ServerWorker;
+class ServerBeacon;
 
 class Server : public QObject
 {
     Q_OBJECT
 public:
     explicit Server(QObject *parent = 0);
+    ~Server();
     void setPassword(QString password);
     void setPlayerName(QString playerName);
+    // zero keeps every session in the server's own thread, otherwise accepted
+    // sockets are spread over that many I/O threads
+    void setThreadCount(int count);
+    int playerCount() const;
+
+public slots:
+    void setOptions(const ConnectionOptions& options);
     void create();
-    void sendMessage(QString message, bool internal);
+    void sendMessage(QString message);
+    void sendData(const QByteArray& data);
+    void sendUnreliable(const QByteArray& data);
+    // replicates the state to every joined player as a delta against what
+    // each of them acknowledged last
+    void publishSnapshot(quint32 id, const StateTable& state);
+    // lockstep, one batch with every player's inputs per tick
+    void sendTick(const QByteArray& payload);
     void ping();
     void close();
 
@@ -24,34 +47,45 @@ signals:
     void createFailure(QString error);
     void playerConnected(QString playerName);
     void playerDisconnected(QString playerName);
-    void messageRead(QString message);
+    void messageRead(QString playerName, QString message);
+    void dataRead(QString playerName, QByteArray data);
+    void unreliableRead(QString playerName, QByteArray data);
+    void inputRead(QString playerName, QByteArray payload);
     void messageSent();
     void messageError();
     void pong(int msecs);
+    void latencyUpdated(QString playerName, QVariantMap statistics);
+    void compressionUpdated(QString playerName, QVariantMap statistics);
+    void congestionChanged(QString playerName, bool congested);
+    void statisticsUpdated(QString playerName, NetworkStatistics statistics);
+    void sendProgress(QString playerName, qint64 bytesSent, qint64 bytesTotal);
+    void receiveProgress(QString playerName, qint64 bytesReceived, qint64 bytesTotal);
 
 private slots:
-    void connectPlayer();
-    void onDisconnected();
-    void readMessage();
+    void dispatchConnection(int socketDescriptor);
+    void onPlayerConnected(QString playerName);
+    void onPlayerDisconnected(QString playerName);
 
 private:
-    void parseMessage(QString message);
-    void onAuthSuccess();
-    void onAuthFail();
+    void startWorkers();
+    void stopWorkers();
 
     QString m_ip;
     QString m_port;
     QString m_player;
     QString m_password;
-    QTcpServer* m_server;
-    QTcpSocket* m_client;
-    QString m_otherPlayerName;
-    QTime* m_pingTime;
-    quint16 blockSize;
-    bool m_authenticated;
+    ServerListener* m_server;
+    ServerBeacon* m_beacon;
+    QList<ServerWorker*> m_workers;
+    QList<QThread*> m_threads;
+    ConnectionOptions m_options;
+    ResumeRegistry m_resumes;
+    NameRegistry m_names;
+    int m_threadCount;
+    // worker that gets the connection when loads are equal
+    int m_nextWorker;
+    int m_players;
     bool m_created;
-    bool m_closed;
-    bool m_otherPlayerConnected;
 };
 
 #endif // SERVER_H
@@ -0,0 +1,88 @@
+#include "serverbeacon.h"
+#include <QUdpSocket>
+#include <QTimer>
+#include <QNetworkInterface>
+
+ServerBeacon::ServerBeacon(QObject *parent) :
+    QObject(parent),
+    m_socket(new QUdpSocket(this)),
+    m_timer(new QTimer(this))
+{
+    m_beacon.version = Protocol::Version;
+    connect(m_socket, SIGNAL(readyRead()), this, SLOT(readProbes()));
+    connect(m_timer, SIGNAL(timeout()), this, SLOT(broadcast()));
+}
+
+bool ServerBeacon::start(quint16 serverPort, int intervalMsecs)
+{
+    m_beacon.port = serverPort;
+    if (m_socket->state() != QAbstractSocket::BoundState && !m_socket->bind(QHostAddress::Any, 0))
+        return false;
+    setInterval(intervalMsecs);
+    return true;
+}
+
+void ServerBeacon::setInterval(int intervalMsecs)
+{
+    if (intervalMsecs <= 0 || m_socket->state() != QAbstractSocket::BoundState) {
+        m_timer->stop();
+        return;
+    }
+    m_timer->start(intervalMsecs);
+    broadcast();
+}
+
+void ServerBeacon::setName(QString name)
+{
+    m_beacon.name = name;
+}
+
+void ServerBeacon::setPlayerCount(int count)
+{
+    m_beacon.players = quint16(qBound(0, count, 0xffff));
+}
+
+void ServerBeacon::stop()
+{
+    m_timer->stop();
+    m_socket->close();
+}
+
+void ServerBeacon::broadcast()
+{
+    // the limited broadcast address only leaves through the default route,
+    // every interface's own broadcast address reaches all attached LANs
+    m_beacon.echo = 0;
+    const QByteArray datagram = Protocol::encodeBeacon(m_beacon);
+    bool sent = false;
+    foreach (const QNetworkInterface& networkInterface, QNetworkInterface::allInterfaces()) {
+        const QNetworkInterface::InterfaceFlags flags = networkInterface.flags();
+        if (!(flags & QNetworkInterface::IsUp) || !(flags & QNetworkInterface::CanBroadcast))
+            continue;
+        foreach (const QNetworkAddressEntry& entry, networkInterface.addressEntries()) {
+            if (entry.broadcast().isNull())
+                continue;
+            m_socket->writeDatagram(datagram, entry.broadcast(), Protocol::DiscoveryPort);
+            sent = true;
+        }
+    }
+    if (!sent)
+        m_socket->writeDatagram(datagram, QHostAddress::Broadcast, Protocol::DiscoveryPort);
+}
+
+void ServerBeacon::readProbes()
+{
+    while (m_socket->hasPendingDatagrams()) {
+        QByteArray datagram(int(m_socket->pendingDatagramSize()), Qt::Uninitialized);
+        QHostAddress sender;
+        quint16 senderPort = 0;
+        if (m_socket->readDatagram(datagram.data(), datagram.size(), &sender, &senderPort) < 0)
+            continue;
+        qint64 originate = 0;
+        if (!Protocol::decodeProbe(datagram, &originate))
+            continue;
+        Protocol::Beacon answer = m_beacon;
+        answer.echo = originate;
+        m_socket->writeDatagram(Protocol::encodeBeacon(answer), sender, senderPort);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef SERVERBEACON_H
+#define SERVERBEACON_H
+
+#include <QObject>
+#include "protocol.h"
+
+class QUdpSocket;
+class QTimer;
+
+// announces a running server on every IPv4 broadcast address and answers
+// probes so listeners can measure the round trip
+class ServerBeacon : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ServerBeacon(QObject *parent = 0);
+    bool start(quint16 serverPort, int intervalMsecs);
+    void setInterval(int intervalMsecs);
+    void setName(QString name);
+    void setPlayerCount(int count);
+    void stop();
+
+private slots:
+    void broadcast();
+    void readProbes();
+
+private:
+    QUdpSocket* m_socket;
+    QTimer* m_timer;
+    Protocol::Beacon m_beacon;
+};
+
+#endif // SERVERBEACON_H
@@ -0,0 +1,132 @@
+#include "serverdiscovery.h"
+#include "networkclock.h"
+#include <QUdpSocket>
+#include <QTimer>
+#include <QVariantMap>
+
+// beacons go out every second by default, a server missing a few is gone
+static const int ExpiryMsecs = 5000;
+static const int ExpiryCheckMsecs = 1000;
+// how often a known server's round trip is measured again
+static const int ProbeIntervalMsecs = 5000;
+
+ServerDiscovery::ServerDiscovery(QObject *parent) :
+    QObject(parent),
+    m_socket(new QUdpSocket(this)),
+    m_expiryTimer(new QTimer(this))
+{
+    connect(m_socket, SIGNAL(readyRead()), this, SLOT(readDatagrams()));
+    connect(m_expiryTimer, SIGNAL(timeout()), this, SLOT(expire()));
+}
+
+bool ServerDiscovery::start()
+{
+    if (isActive())
+        return true;
+    // several listeners on one host share the port
+    if (!m_socket->bind(QHostAddress::Any, Protocol::DiscoveryPort,
+                        QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint)) {
+        qDebug("could not listen for server beacons: %s", qPrintable(m_socket->errorString()));
+        return false;
+    }
+    m_clock.start();
+    m_expiryTimer->start(ExpiryCheckMsecs);
+    return true;
+}
+
+void ServerDiscovery::stop()
+{
+    m_expiryTimer->stop();
+    m_socket->close();
+    if (!m_servers.isEmpty()) {
+        m_servers.clear();
+        emit serversChanged();
+    }
+}
+
+bool ServerDiscovery::isActive() const
+{
+    return m_socket->state() == QAbstractSocket::BoundState;
+}
+
+QVariantList ServerDiscovery::servers() const
+{
+    QVariantList servers;
+    foreach (const Entry& entry, m_servers) {
+        QVariantMap server;
+        server.insert("name", entry.beacon.name);
+        server.insert("ip", entry.address.toString());
+        server.insert("port", QString::number(entry.beacon.port));
+        server.insert("players", entry.beacon.players);
+        server.insert("version", entry.beacon.version);
+        server.insert("compatible", entry.beacon.version >= Protocol::MinimumVersion
+                      && entry.beacon.version <= Protocol::Version);
+        server.insert("latency", entry.latencyMsecs);
+        servers.append(server);
+    }
+    return servers;
+}
+
+void ServerDiscovery::probe(Entry* entry)
+{
+    entry->probeSent = NetworkClock::currentTimeUsecs();
+    m_socket->writeDatagram(Protocol::encodeProbe(entry->probeSent), entry->address, entry->beaconPort);
+}
+
+void ServerDiscovery::readDatagrams()
+{
+    bool changed = false;
+    while (m_socket->hasPendingDatagrams()) {
+        QByteArray datagram(int(m_socket->pendingDatagramSize()), Qt::Uninitialized);
+        QHostAddress sender;
+        quint16 senderPort = 0;
+        if (m_socket->readDatagram(datagram.data(), datagram.size(), &sender, &senderPort) < 0)
+            continue;
+        Protocol::Beacon beacon;
+        if (!Protocol::decodeBeacon(datagram, &beacon))
+            continue;
+
+        const QString key = sender.toString() + ':' + QString::number(beacon.port);
+        const bool known = m_servers.contains(key);
+        Entry& entry = m_servers[key];
+        if (!known || entry.beacon.name != beacon.name || entry.beacon.players != beacon.players
+                || entry.beacon.version != beacon.version)
+            changed = true;
+        entry.address = sender;
+        entry.beaconPort = senderPort;
+        entry.lastSeen = m_clock.elapsed();
+        const qint64 echo = beacon.echo;
+        beacon.echo = 0;
+        entry.beacon = beacon;
+
+        if (echo && echo == entry.probeSent) {
+            entry.latencyMsecs = (NetworkClock::currentTimeUsecs() - echo) / 1000.0;
+            entry.probeSent = 0;
+            changed = true;
+        } else if (!known) {
+            probe(&entry);
+        }
+    }
+    if (changed)
+        emit serversChanged();
+}
+
+void ServerDiscovery::expire()
+{
+    const qint64 now = m_clock.elapsed();
+    bool changed = false;
+    QHash<QString, Entry>::iterator it = m_servers.begin();
+    while (it != m_servers.end()) {
+        if (now - it->lastSeen > ExpiryMsecs) {
+            it = m_servers.erase(it);
+            changed = true;
+            continue;
+        }
+        // a probe that never came back is simply sent again
+        if (now / ProbeIntervalMsecs != (now - ExpiryCheckMsecs) / ProbeIntervalMsecs)
+            probe(&it.value());
+        ++it;
+    }
+    if (changed)
+        emit serversChanged();
+}
@@ -0,0 +1,58 @@
+#ifndef SERVERDISCOVERY_H
+#define SERVERDISCOVERY_H
+
+#include <QObject>
+#include <QHostAddress>
+#include <QHash>
+#include <QVariantList>
+#include <QElapsedTimer>
+#include "protocol.h"
+
+class QUdpSocket;
+class QTimer;
+
+// listens for server beacons on the LAN and keeps one entry per server,
+// dropping those that have gone quiet
+class ServerDiscovery : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ServerDiscovery(QObject *parent = 0);
+    bool start();
+    void stop();
+    bool isActive() const;
+    // name, ip, port, players, version, compatible and latency, the probe
+    // round trip in milliseconds or -1 until one has come back
+    QVariantList servers() const;
+
+signals:
+    void serversChanged();
+
+private slots:
+    void readDatagrams();
+    void expire();
+
+private:
+    struct Entry
+    {
+        Entry() : beaconPort(0), lastSeen(0), probeSent(0), latencyMsecs(-1) {}
+        QHostAddress address;
+        // where the server's beacons come from, probes go there
+        quint16 beaconPort;
+        Protocol::Beacon beacon;
+        qint64 lastSeen;
+        qint64 probeSent;
+        double latencyMsecs;
+    };
+
+    void probe(Entry* entry);
+
+    QUdpSocket* m_socket;
+    QTimer* m_expiryTimer;
+    QElapsedTimer m_clock;
+    // keyed by address and game port, the same server heard on several
+    // interfaces stays one entry
+    QHash<QString, Entry> m_servers;
+};
+
+#endif // SERVERDISCOVERY_H
@@ -0,0 +1,11 @@
+#include "serverlistener.h"
+
+ServerListener::ServerListener(QObject *parent) :
+    QTcpServer(parent)
+{
+}
+
+void ServerListener::incomingConnection(int socketDescriptor)
+{
+    emit connectionAccepted(socketDescriptor);
+}
@@ -0,0 +1,21 @@
+#ifndef SERVERLISTENER_H
+#define SERVERLISTENER_H
+
+#include <QTcpServer>
+
+// accepts connections without creating sockets, the descriptor is handed on
+// so the socket can be created in the thread that is going to own it
+class ServerListener : public QTcpServer
+{
+    Q_OBJECT
+public:
+    explicit ServerListener(QObject *parent = 0);
+
+signals:
+    void connectionAccepted(int socketDescriptor);
+
+protected:
+    void incomingConnection(int socketDescriptor);
+};
+
+#endif // SERVERLISTENER_H
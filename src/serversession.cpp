@@ -0,0 +1,561 @@
+#include "serversession.h"
+#include "framewriter.h"
+#include "networkclock.h"
+#include "trace.h"
+#include "unreliablechannel.h"
+#include <QTcpSocket>
+#include <QTimer>
+#include <QElapsedTimer>
+
+// the token alone lets a connection take over a player, 128 bits from the
+// system's generator. Empty when there is none, the session is then not
+// resumable
+static QByteArray newResumeToken()
+{
+    QByteArray token(16, Qt::Uninitialized);
+    if (!Protocol::randomBytes(token.data(), token.size()))
+        return QByteArray();
+    return token;
+}
+
+ServerSession::ServerSession(QTcpSocket* socket, QObject *parent) :
+    QObject(parent),
+    m_socket(socket),
+    m_receivedAt(0),
+    m_pingTimer(new QTimer(this)),
+    m_heartbeatTimer(new QTimer(this)),
+    m_missedHeartbeats(0),
+    m_statisticsTimer(new QTimer(this)),
+    m_names(NULL),
+    m_writer(NULL),
+    m_channel(NULL),
+    m_version(0),
+    m_capabilities(0),
+    m_acknowledgedSnapshot(0),
+    m_received(0),
+    m_authenticated(false),
+    m_joined(false),
+    m_closing(false)
+{
+    m_socket->setParent(this);
+    connect(m_socket, SIGNAL(readyRead()), this, SLOT(readMessage()));
+    connect(m_socket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
+    connect(m_pingTimer, SIGNAL(timeout()), this, SLOT(ping()));
+    connect(m_heartbeatTimer, SIGNAL(timeout()), this, SLOT(checkHeartbeat()));
+    connect(m_statisticsTimer, SIGNAL(timeout()), this, SLOT(flushStatistics()));
+    m_writer = new FrameWriter(m_socket, this);
+    connect(m_writer, SIGNAL(sendProgress(qint64,qint64)), this, SLOT(onSendProgress(qint64,qint64)));
+    connect(m_writer, SIGNAL(congestionChanged(bool)), this, SLOT(onCongestionChanged(bool)));
+    connect(m_writer, SIGNAL(stalled()), this, SLOT(onStalled()));
+}
+
+void ServerSession::setPassword(QString password)
+{
+    m_password = password;
+}
+
+void ServerSession::setPlayerName(QString playerName)
+{
+    m_player = playerName;
+}
+
+void ServerSession::setNameRegistry(NameRegistry* names)
+{
+    m_names = names;
+}
+
+void ServerSession::setOptions(const ConnectionOptions& options)
+{
+    m_options = options;
+    m_writer->setOptions(options);
+    m_compressor.setDictionary(options.compressionDictionary);
+    if (m_options.statisticsIntervalMsecs > 0) {
+        m_statisticsTimer->start(m_options.statisticsIntervalMsecs);
+    } else {
+        m_statisticsTimer->stop();
+    }
+    updatePingTimer();
+    updateHeartbeatTimer();
+}
+
+void ServerSession::updatePingTimer()
+{
+    if (m_joined && m_options.pingIntervalMsecs > 0) {
+        m_pingTimer->start(m_options.pingIntervalMsecs);
+    } else {
+        m_pingTimer->stop();
+    }
+}
+
+void ServerSession::updateHeartbeatTimer()
+{
+    m_missedHeartbeats = 0;
+    if (m_joined && (m_capabilities & Protocol::KeepAlive) && m_options.heartbeatIntervalMsecs > 0) {
+        m_heartbeatTimer->start(m_options.heartbeatIntervalMsecs);
+    } else {
+        m_heartbeatTimer->stop();
+    }
+}
+
+void ServerSession::checkHeartbeat()
+{
+    // whatever arrived since the last check answers for the peer
+    const qint64 silentMsecs = (NetworkClock::currentTimeUsecs() - m_receivedAt) / 1000;
+    if (silentMsecs < m_options.heartbeatIntervalMsecs) {
+        m_missedHeartbeats = 0;
+        return;
+    }
+    if (m_missedHeartbeats >= m_options.heartbeatMisses) {
+        // no FIN came, the socket would look connected for minutes; a
+        // resumable session is parked as for any other drop
+        qDebug("%s stopped answering, disconnecting", qPrintable(m_otherPlayerName));
+        m_socket->abort();
+        return;
+    }
+    ++m_missedHeartbeats;
+    sendFrame(Protocol::Heartbeat);
+}
+
+QString ServerSession::otherPlayerName() const
+{
+    return m_otherPlayerName;
+}
+
+bool ServerSession::isJoined() const
+{
+    return m_joined;
+}
+
+quint32 ServerSession::capabilities() const
+{
+    return m_capabilities;
+}
+
+quint32 ServerSession::acknowledgedSnapshot() const
+{
+    return m_acknowledgedSnapshot;
+}
+
+void ServerSession::onDisconnected()
+{
+    qDebug("client %s disconnected on server side", qPrintable(m_otherPlayerName));
+    TRACE(Sessions, SessionLeft, 0, 0);
+    m_authenticated = false;
+    m_pingTimer->stop();
+    m_heartbeatTimer->stop();
+    m_statisticsTimer->stop();
+    flushStatistics();
+    if (isResumable())
+        m_replay = m_writer->takeReplayState();
+    m_writer->clear();
+    if (m_channel) {
+        m_channel->deleteLater();
+        m_channel = NULL;
+    }
+    emit left(this);
+}
+
+void ServerSession::readMessage()
+{
+    // drain every complete frame, several may have arrived in one segment
+    m_receivedAt = NetworkClock::currentTimeUsecs();
+    QElapsedTimer timer;
+    timer.start();
+    const qint64 available = m_socket->bytesAvailable();
+    TRACE(Frames, ReadBegin, available, 0);
+    Protocol::Frame frame;
+    int frames = 0;
+    while (m_socket->state() == QAbstractSocket::ConnectedState && m_decoder.readFrame(m_socket, &frame)) {
+        ++frames;
+        ++m_statistics.framesIn;
+        ++m_statistics.framesInByOpcode[frame.opcode & ~Protocol::CompressedFlag];
+        TRACE(Frames, FrameReceived, frame.opcode, frame.payload.size());
+        parseFrame(frame);
+    }
+    TRACE(Frames, ReadEnd, frames, 0);
+    m_statistics.bytesIn += available - m_socket->bytesAvailable();
+    m_statistics.parseNsecs += timer.nsecsElapsed();
+    if (m_decoder.hasError()) {
+        qDebug("malformed frame or legacy client, disconnecting");
+        m_closing = true;
+        m_socket->abort();
+    }
+}
+
+void ServerSession::parseFrame(const Protocol::Frame& frame)
+{
+    if (!m_version) {
+        if (frame.opcode == Protocol::Hello) {
+            onHello(frame.payload);
+        } else {
+            onAuthFail();
+        }
+        return;
+    }
+
+    if (!m_authenticated) {
+        if (frame.opcode == Protocol::Resume && (m_capabilities & Protocol::Resumable)) {
+            QByteArray token;
+            quint64 received = 0;
+            if (Protocol::decodeResume(frame.payload, &token, &received)) {
+                emit resumeRequested(this, token, received);
+            } else {
+                reject("resume");
+            }
+            return;
+        }
+        if (frame.opcode == Protocol::Password && Protocol::decodeText(frame.payload, m_capabilities) == m_password) {
+            onAuthSuccess();
+        } else {
+            onAuthFail();
+        }
+        return;
+    }
+
+    if (frame.opcode & Protocol::CompressedFlag) {
+        Protocol::Frame plain;
+        plain.opcode = frame.opcode & ~Protocol::CompressedFlag;
+        if (!(m_capabilities & Protocol::Compression) || !m_compressor.decompress(frame.payload, &plain.payload)) {
+            qDebug("undecodable compressed frame from %s, disconnecting", qPrintable(m_otherPlayerName));
+            m_socket->abort();
+            return;
+        }
+        emit compressionUpdated(this, m_compressor.statistics());
+        parseFrame(plain);
+        return;
+    }
+
+    // numbered the same way the client's writer numbers them, see FrameWriter::replay
+    if (m_joined && Protocol::isReplayable(frame.opcode))
+        ++m_received;
+
+    switch (frame.opcode) {
+    case Protocol::Username:
+        if (!m_joined) {
+            const QString name = Protocol::decodeText(frame.payload, m_capabilities);
+            // everything about a player is keyed by its name, a second one
+            // with the same name would take over the first one's state
+            if (name == m_player || (m_names && !m_names->claim(name))) {
+                qDebug("player name %s is taken, rejecting", qPrintable(name));
+                m_closing = true;
+                reject("name");
+                break;
+            }
+            m_otherPlayerName = name;
+            qDebug("user %s joined server", qPrintable(m_otherPlayerName));
+            m_joined = true;
+            TRACE(Sessions, SessionJoined, m_capabilities, 0);
+            if (m_capabilities & Protocol::NameCheck)
+                sendFrame(Protocol::Joined);
+            if (m_capabilities & Protocol::Resumable)
+                m_resumeToken = newResumeToken();
+            if (!m_resumeToken.isEmpty()) {
+                m_writer->setReplayEnabled(true);
+                sendFrame(Protocol::ResumeToken, m_resumeToken);
+            }
+            updatePingTimer();
+            updateHeartbeatTimer();
+            emit joined(this);
+        }
+        break;
+    case Protocol::Reject:
+        // the client is leaving for good
+        m_closing = true;
+        break;
+    case Protocol::Message:
+        if (m_joined) {
+            emit messageRead(this, Protocol::decodeText(frame.payload, m_capabilities));
+        }
+        break;
+    case Protocol::Data:
+        if (m_joined) {
+            emit dataRead(this, frame.payload);
+        }
+        break;
+    case Protocol::FragmentBegin:
+    case Protocol::FragmentData:
+        if (m_joined) {
+            onFragment(frame);
+        }
+        break;
+    case Protocol::Input:
+        if (m_joined) {
+            emit inputRead(this, frame.payload);
+        }
+        break;
+    case Protocol::SnapshotAck:
+        if (m_joined) {
+            quint32 id = 0;
+            // ids only grow, an ack that arrives late changes nothing
+            if (Protocol::decodeSnapshotAck(frame.payload, &id) && qint32(id - m_acknowledgedSnapshot) > 0)
+                m_acknowledgedSnapshot = id;
+        }
+        break;
+    case Protocol::Ping:
+        onPing(frame.payload);
+        break;
+    case Protocol::Pong:
+        onPong(frame.payload);
+        break;
+    case Protocol::Heartbeat:
+        sendFrame(Protocol::HeartbeatAck);
+        break;
+    default:
+        // discard anything else, heartbeat acks only had to arrive
+        break;
+    }
+}
+
+void ServerSession::onHello(const QByteArray& payload)
+{
+    quint8 version = 0;
+    quint32 capabilities = 0;
+    if (!Protocol::decodeHello(payload, &version, &capabilities) || version < Protocol::MinimumVersion) {
+        qDebug("client protocol version %d not supported", version);
+        reject("version");
+        return;
+    }
+    // confirm what both ends understand, the client waits for this before it
+    // sends anything that depends on it
+    m_version = qMin(version, Protocol::Version);
+    quint32 supported = Protocol::SupportedCapabilities;
+    if (m_options.unreliableChannel)
+        supported |= Protocol::Unreliable;
+    if (m_options.resumeTimeoutMsecs > 0)
+        supported |= Protocol::Resumable;
+    m_capabilities = capabilities & supported;
+    m_writer->setFragmentationEnabled(m_capabilities & Protocol::Fragments);
+    sendFrame(Protocol::Hello, Protocol::encodeHello(m_version, m_capabilities));
+}
+
+void ServerSession::onFragment(const Protocol::Frame& frame)
+{
+    Protocol::Frame complete;
+    qint64 received = 0;
+    qint64 total = 0;
+    const bool done = m_assembler.addFragment(frame, &complete, &received, &total);
+    if (m_assembler.hasError()) {
+        qDebug("broken fragment stream from %s, disconnecting", qPrintable(m_otherPlayerName));
+        m_socket->abort();
+        return;
+    }
+    emit receiveProgress(this, received, total);
+    if (done) {
+        parseFrame(complete);
+    }
+}
+
+void ServerSession::onPing(const QByteArray& payload)
+{
+    quint32 sequence = 0;
+    qint64 originate = 0;
+    if (!Protocol::decodePing(payload, &sequence, &originate))
+        return;
+    sendFrame(Protocol::Pong, Protocol::encodePong(sequence, originate, m_receivedAt,
+                                                   NetworkClock::currentTimeUsecs()));
+}
+
+void ServerSession::onPong(const QByteArray& payload)
+{
+    // only clients care about the other end's clock
+    quint32 sequence = 0;
+    qint64 originate = 0;
+    qint64 received = 0;
+    qint64 transmit = 0;
+    if (!Protocol::decodePong(payload, &sequence, &originate, &received, &transmit))
+        return;
+    const qint64 rtt = m_latency.finishPing(sequence);
+    if (rtt < 0)
+        return; // stray or stale pong
+    emit pong(int((rtt + 500) / 1000));
+    emit latencyUpdated(this, m_latency.statistics());
+}
+
+void ServerSession::onSendProgress(qint64 bytesSent, qint64 bytesTotal)
+{
+    emit sendProgress(this, bytesSent, bytesTotal);
+}
+
+void ServerSession::onCongestionChanged(bool congested)
+{
+    emit congestionChanged(this, congested);
+}
+
+void ServerSession::onStalled()
+{
+    qDebug("%s is not keeping up, disconnecting", qPrintable(m_otherPlayerName));
+    m_closing = true;
+    m_socket->abort();
+}
+
+void ServerSession::flushStatistics()
+{
+    NetworkStatistics statistics = m_statistics;
+    statistics += m_writer->takeStatistics();
+    m_statistics = NetworkStatistics();
+    if (!statistics.isEmpty() || statistics.sendQueueBytes > 0)
+        emit statisticsUpdated(this, statistics);
+}
+
+void ServerSession::onAuthSuccess()
+{
+    qDebug("client successfully authenticated, sending username");
+    m_authenticated = true;
+    if (m_capabilities & Protocol::Unreliable)
+        offerUnreliableChannel();
+    sendFrame(Protocol::Username, Protocol::encodeText(m_player, m_capabilities));
+}
+
+void ServerSession::offerUnreliableChannel()
+{
+    // the token ties datagrams to this session, the client's address is
+    // taken from its first hello since NAT may change the source port
+    quint32 token = 0;
+    if (!Protocol::randomBytes(reinterpret_cast<char*>(&token), sizeof(token))) {
+        qDebug("no random source, continuing without unreliable channel");
+        return;
+    }
+    m_channel = new UnreliableChannel(token, this);
+    if (!m_channel->bind()) {
+        qDebug("could not bind UDP socket, continuing without unreliable channel");
+        delete m_channel;
+        m_channel = NULL;
+        return;
+    }
+    connect(m_channel, SIGNAL(datagramRead(QByteArray)), this, SLOT(onDatagramRead(QByteArray)));
+    sendFrame(Protocol::UdpOffer, Protocol::encodeUdpOffer(m_channel->localPort(), token));
+}
+
+void ServerSession::onDatagramRead(QByteArray data)
+{
+    if (m_joined)
+        emit unreliableRead(this, data);
+}
+
+void ServerSession::onAuthFail()
+{
+    ++m_statistics.authFailures;
+    TRACE(Sessions, AuthFailed, 0, 0);
+    qDebug("authentication failure, disconnecting");
+    reject("auth");
+}
+
+void ServerSession::reject(QString reason)
+{
+    sendFrame(Protocol::Reject, Protocol::encodeText(reason, m_capabilities));
+    // a batched reject would still sit in the writer when the socket closes
+    m_writer->flush();
+    m_socket->disconnectFromHost();
+}
+
+void ServerSession::sendFrame(quint8 opcode, const QByteArray& payload)
+{
+    m_writer->writeFrame(opcode, payload);
+}
+
+void ServerSession::sendBlock(const QByteArray& block)
+{
+    m_writer->writeBlock(block);
+}
+
+void ServerSession::sendPayload(quint8 opcode, SharedPayload* shared)
+{
+    const QByteArray* payload = &shared->payload;
+    QByteArray* block = &shared->block;
+    if ((m_capabilities & Protocol::Compression) && m_options.compressionThreshold > 0
+            && shared->payload.size() >= m_options.compressionThreshold) {
+        // the first session compresses, the others only account for it
+        if (!shared->compressionTried) {
+            shared->compressionTried = true;
+            m_compressor.compress(shared->payload, &shared->compressed);
+        } else if (!shared->compressed.isNull()) {
+            m_compressor.addSent(shared->payload.size(), shared->compressed.size());
+        }
+        if (!shared->compressed.isNull()) {
+            opcode |= Protocol::CompressedFlag;
+            payload = &shared->compressed;
+            block = &shared->compressedBlock;
+            emit compressionUpdated(this, m_compressor.statistics());
+        }
+    }
+
+    if (m_writer->needsFragmenting(*payload)) {
+        m_writer->writeFrame(opcode, *payload);
+    } else {
+        if (block->isNull())
+            *block = FrameDecoder::encodeFrame(opcode, *payload);
+        m_writer->writeBlock(*block);
+    }
+}
+
+void ServerSession::sendUnreliable(const QByteArray& data)
+{
+    if (m_channel)
+        m_channel->send(data);
+}
+
+void ServerSession::ping()
+{
+    sendFrame(Protocol::Ping, Protocol::encodePing(m_latency.startPing(), NetworkClock::currentTimeUsecs()));
+}
+
+bool ServerSession::isResumable() const
+{
+    return m_joined && !m_closing && !m_resumeToken.isEmpty();
+}
+
+QByteArray ServerSession::resumeToken() const
+{
+    return m_resumeToken;
+}
+
+ResumeState ServerSession::takeResumeState()
+{
+    ResumeState state;
+    state.token = m_resumeToken;
+    state.playerName = m_otherPlayerName;
+    state.capabilities = m_capabilities;
+    state.received = m_received;
+    state.replay = m_replay;
+    m_replay = ReplayState();
+    return state;
+}
+
+bool ServerSession::resume(const ResumeState& state, quint64 peerReceived)
+{
+    // replayed frames were encoded for the old negotiation
+    if (state.capabilities != m_capabilities || !FrameWriter::canReplay(state.replay, peerReceived))
+        return false;
+    qDebug("user %s resumed its session", qPrintable(state.playerName));
+    m_otherPlayerName = state.playerName;
+    m_resumeToken = state.token;
+    m_received = state.received;
+    m_authenticated = true;
+    m_joined = true;
+    TRACE(Sessions, SessionJoined, m_capabilities, 0);
+    m_writer->setReplayEnabled(true);
+    sendFrame(Protocol::Resumed, Protocol::encodeResumed(m_received));
+    m_writer->replay(state.replay, peerReceived);
+    if (m_capabilities & Protocol::Unreliable)
+        offerUnreliableChannel();
+    updatePingTimer();
+    updateHeartbeatTimer();
+    return true;
+}
+
+void ServerSession::abort()
+{
+    m_socket->abort();
+}
+
+void ServerSession::close()
+{
+    m_closing = true;
+    // said out loud, a client must not take the disconnect for a drop and
+    // keep trying to resume
+    if (m_version) {
+        sendFrame(Protocol::Reject, Protocol::encodeText("closed", m_capabilities));
+        m_writer->flush();
+    }
+    m_socket->disconnectFromHost();
+}
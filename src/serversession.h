@@ -0,0 +1,141 @@
+#ifndef SERVERSESSION_H
+#define SERVERSESSION_H
+
+#include <QObject>
+#include <QVariantMap>
+#include "framedecoder.h"
+#include "fragmentassembler.h"
+#include "connectionoptions.h"
+#include "latencytracker.h"
+#include "payloadcompressor.h"
+#include "resumeregistry.h"
+#include "nameregistry.h"
+#include "include/networkstatistics.h"
+
+class QTcpSocket;
+class FrameWriter;
+class UnreliableChannel;
+class QTimer;
+
+// one outgoing payload with its encodings, every session that sends it the
+// same way reuses them instead of encoding and compressing again
+struct SharedPayload
+{
+    explicit SharedPayload(const QByteArray& data = QByteArray()) :
+        payload(data),
+        compressionTried(false)
+    {}
+    QByteArray payload;
+    QByteArray block;
+    QByteArray compressed;
+    QByteArray compressedBlock;
+    bool compressionTried;
+};
+
+// one connected peer on the server side, with its own framing and auth state
+class ServerSession : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ServerSession(QTcpSocket* socket, QObject *parent = 0);
+    void setPassword(QString password);
+    void setPlayerName(QString playerName);
+    // names taken by other players, a client asking for one is rejected
+    void setNameRegistry(NameRegistry* names);
+    void setOptions(const ConnectionOptions& options);
+    QString otherPlayerName() const;
+    bool isJoined() const;
+    quint32 capabilities() const;
+    // newest replicated snapshot the client has confirmed, zero for none
+    quint32 acknowledgedSnapshot() const;
+    void sendFrame(quint8 opcode, const QByteArray& payload = QByteArray());
+    void sendBlock(const QByteArray& block);
+    // small payloads are encoded once and shared by every caller passing the
+    // same SharedPayload, large ones are streamed per session
+    void sendPayload(quint8 opcode, SharedPayload* shared);
+    // dropped while no UDP channel is established
+    void sendUnreliable(const QByteArray& data);
+    // joined with a resume token and lost without either side closing it
+    bool isResumable() const;
+    QByteArray resumeToken() const;
+    ResumeState takeResumeState();
+    // takes over a dropped session, false when it cannot be continued
+    bool resume(const ResumeState& state, quint64 peerReceived);
+    void reject(QString reason);
+    // drops the connection without closing it, it stays resumable
+    void abort();
+    void close();
+
+public slots:
+    void ping();
+
+signals:
+    void joined(ServerSession* session);
+    void left(ServerSession* session);
+    void messageRead(ServerSession* session, QString message);
+    void dataRead(ServerSession* session, QByteArray data);
+    void unreliableRead(ServerSession* session, QByteArray data);
+    void inputRead(ServerSession* session, QByteArray payload);
+    void resumeRequested(ServerSession* session, QByteArray token, quint64 received);
+    void pong(int msecs);
+    void latencyUpdated(ServerSession* session, QVariantMap statistics);
+    void compressionUpdated(ServerSession* session, QVariantMap statistics);
+    void congestionChanged(ServerSession* session, bool congested);
+    // counters since the previous update
+    void statisticsUpdated(ServerSession* session, NetworkStatistics statistics);
+    void sendProgress(ServerSession* session, qint64 bytesSent, qint64 bytesTotal);
+    void receiveProgress(ServerSession* session, qint64 bytesReceived, qint64 bytesTotal);
+
+private slots:
+    void onDisconnected();
+    void readMessage();
+    void onSendProgress(qint64 bytesSent, qint64 bytesTotal);
+    void onDatagramRead(QByteArray data);
+    void onCongestionChanged(bool congested);
+    void onStalled();
+    void flushStatistics();
+    void checkHeartbeat();
+
+private:
+    void parseFrame(const Protocol::Frame& frame);
+    void onHello(const QByteArray& payload);
+    void onFragment(const Protocol::Frame& frame);
+    void onPing(const QByteArray& payload);
+    void onPong(const QByteArray& payload);
+    void updatePingTimer();
+    void updateHeartbeatTimer();
+    void onAuthSuccess();
+    void offerUnreliableChannel();
+    void onAuthFail();
+
+    QTcpSocket* m_socket;
+    QString m_player;
+    QString m_password;
+    QString m_otherPlayerName;
+    LatencyTracker m_latency;
+    qint64 m_receivedAt;
+    QTimer* m_pingTimer;
+    QTimer* m_heartbeatTimer;
+    int m_missedHeartbeats;
+    QTimer* m_statisticsTimer;
+    NetworkStatistics m_statistics;
+    ConnectionOptions m_options;
+    NameRegistry* m_names;
+    FrameDecoder m_decoder;
+    FrameWriter* m_writer;
+    FragmentAssembler m_assembler;
+    PayloadCompressor m_compressor;
+    UnreliableChannel* m_channel;
+    quint8 m_version;
+    quint32 m_capabilities;
+    quint32 m_acknowledgedSnapshot;
+    QByteArray m_resumeToken;
+    quint64 m_received;
+    ReplayState m_replay;
+    bool m_authenticated;
+    bool m_joined;
+    // closed on purpose by either side, not worth keeping for resumption
+    bool m_closing;
+};
+
+#endif // SERVERSESSION_H
@@ -0,0 +1,368 @@
+#include "serverworker.h"
+#include "serversession.h"
+#include "resumeregistry.h"
+#include "nameregistry.h"
+#include "trace.h"
+#include <QTcpSocket>
+#include <QTimer>
+
+// parked sessions are only checked this often, they may outlive their
+// timeout by as much
+static const int ExpiryCheckMsecs = 1000;
+
+ServerWorker::ServerWorker(QObject *parent) :
+    QObject(parent),
+    m_load(0),
+    m_resumes(0),
+    m_names(0),
+    m_expiryTimer(new QTimer(this))
+{
+    connect(m_expiryTimer, SIGNAL(timeout()), this, SLOT(expireDetached()));
+    m_clock.start();
+}
+
+void ServerWorker::setPassword(QString password)
+{
+    m_password = password;
+}
+
+void ServerWorker::setPlayerName(QString playerName)
+{
+    m_player = playerName;
+}
+
+void ServerWorker::setResumeRegistry(ResumeRegistry* registry)
+{
+    m_resumes = registry;
+}
+
+void ServerWorker::setNameRegistry(NameRegistry* names)
+{
+    m_names = names;
+}
+
+int ServerWorker::load() const
+{
+    return m_load;
+}
+
+void ServerWorker::reserveConnection()
+{
+    m_load.ref();
+}
+
+void ServerWorker::setOptions(const ConnectionOptions& options)
+{
+    m_options = options;
+    foreach (ServerSession* session, m_sessions) {
+        session->setOptions(m_options);
+    }
+}
+
+void ServerWorker::addConnection(int socketDescriptor)
+{
+    QTcpSocket* socket = new QTcpSocket;
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        qDebug("could not take over accepted socket: %s", qPrintable(socket->errorString()));
+        delete socket;
+        m_load.deref();
+        return;
+    }
+
+    ServerSession* session = new ServerSession(socket, this);
+    session->setPassword(m_password);
+    session->setPlayerName(m_player);
+    session->setNameRegistry(m_names);
+    session->setOptions(m_options);
+    connect(session, SIGNAL(joined(ServerSession*)), this, SLOT(onSessionJoined(ServerSession*)));
+    connect(session, SIGNAL(left(ServerSession*)), this, SLOT(onSessionLeft(ServerSession*)));
+    connect(session, SIGNAL(messageRead(ServerSession*,QString)),
+            this, SLOT(onSessionMessage(ServerSession*,QString)));
+    connect(session, SIGNAL(dataRead(ServerSession*,QByteArray)),
+            this, SLOT(onSessionData(ServerSession*,QByteArray)));
+    connect(session, SIGNAL(unreliableRead(ServerSession*,QByteArray)),
+            this, SLOT(onSessionUnreliable(ServerSession*,QByteArray)));
+    connect(session, SIGNAL(inputRead(ServerSession*,QByteArray)),
+            this, SLOT(onSessionInput(ServerSession*,QByteArray)));
+    connect(session, SIGNAL(resumeRequested(ServerSession*,QByteArray,quint64)),
+            this, SLOT(onSessionResume(ServerSession*,QByteArray,quint64)));
+    connect(session, SIGNAL(pong(int)), this, SIGNAL(pong(int)));
+    connect(session, SIGNAL(latencyUpdated(ServerSession*,QVariantMap)),
+            this, SLOT(onSessionLatency(ServerSession*,QVariantMap)));
+    connect(session, SIGNAL(compressionUpdated(ServerSession*,QVariantMap)),
+            this, SLOT(onSessionCompression(ServerSession*,QVariantMap)));
+    connect(session, SIGNAL(congestionChanged(ServerSession*,bool)),
+            this, SLOT(onSessionCongestion(ServerSession*,bool)));
+    connect(session, SIGNAL(statisticsUpdated(ServerSession*,NetworkStatistics)),
+            this, SLOT(onSessionStatistics(ServerSession*,NetworkStatistics)));
+    connect(session, SIGNAL(sendProgress(ServerSession*,qint64,qint64)),
+            this, SLOT(onSessionSendProgress(ServerSession*,qint64,qint64)));
+    connect(session, SIGNAL(receiveProgress(ServerSession*,qint64,qint64)),
+            this, SLOT(onSessionReceiveProgress(ServerSession*,qint64,qint64)));
+    m_sessions.append(session);
+}
+
+void ServerWorker::sendFullSnapshot(ServerSession* session)
+{
+    const quint32 latest = m_snapshots.latestId();
+    if (latest != SnapshotHistory::NoSnapshot) {
+        SharedPayload full(m_snapshots.encode(latest, SnapshotHistory::NoSnapshot));
+        session->sendPayload(Protocol::Snapshot, &full);
+    }
+}
+
+void ServerWorker::onSessionJoined(ServerSession* session)
+{
+    // late joiners get the whole current state right away
+    sendFullSnapshot(session);
+    emit playerConnected(session->otherPlayerName());
+}
+
+void ServerWorker::onSessionLeft(ServerSession* session)
+{
+    if (!m_sessions.removeAll(session))
+        return;
+    m_load.deref();
+    if (m_resumes && m_options.resumeTimeoutMsecs > 0 && session->isResumable()) {
+        // the player stays in the game until the timeout, its client may come back
+        qDebug("keeping session of %s for resumption", qPrintable(session->otherPlayerName()));
+        const ResumeState state = session->takeResumeState();
+        m_resumes->store(state);
+        Detached detached;
+        detached.expiresAt = m_clock.elapsed() + m_options.resumeTimeoutMsecs;
+        detached.capabilities = state.capabilities;
+        detached.playerName = state.playerName;
+        m_detached.insert(state.token, detached);
+        if (!m_expiryTimer->isActive())
+            m_expiryTimer->start(ExpiryCheckMsecs);
+    } else if (session->isJoined()) {
+        removePlayer(session->otherPlayerName());
+    }
+    session->deleteLater();
+}
+
+void ServerWorker::removePlayer(QString playerName)
+{
+    if (m_names)
+        m_names->release(playerName);
+    emit playerDisconnected(playerName);
+}
+
+void ServerWorker::onSessionResume(ServerSession* session, QByteArray token, quint64 received)
+{
+    ResumeState state;
+    if (m_resumes && !m_resumes->take(token, &state)) {
+        // the old connection may not have noticed it is gone yet
+        foreach (ServerSession* stale, m_sessions) {
+            if (stale != session && Protocol::equalTokens(stale->resumeToken(), token)) {
+                stale->abort();
+                break;
+            }
+        }
+    }
+    if (!m_resumes || (state.token.isEmpty() && !m_resumes->take(token, &state))) {
+        session->reject("resume");
+        return;
+    }
+    // whichever worker parked it stops counting down once the token is gone
+    m_detached.remove(token);
+    if (!session->resume(state, received)) {
+        qDebug("could not resume session of %s", qPrintable(state.playerName));
+        session->reject("resume");
+        removePlayer(state.playerName);
+        return;
+    }
+    // replicated state is sent whole rather than replayed, the client
+    // dropped its snapshot history with the connection
+    sendFullSnapshot(session);
+}
+
+void ServerWorker::expireDetached()
+{
+    const qint64 now = m_clock.elapsed();
+    QMap<QByteArray, Detached>::iterator it = m_detached.begin();
+    while (it != m_detached.end()) {
+        if (it->expiresAt > now) {
+            ++it;
+            continue;
+        }
+        ResumeState state;
+        if (m_resumes && m_resumes->take(it.key(), &state)) {
+            qDebug("session of %s was not resumed in time", qPrintable(state.playerName));
+            removePlayer(state.playerName);
+        }
+        it = m_detached.erase(it);
+    }
+    if (m_detached.isEmpty())
+        m_expiryTimer->stop();
+}
+
+void ServerWorker::appendDetached(quint8 opcode, const QByteArray& payload, const QByteArray& legacyPayload)
+{
+    if (!m_resumes)
+        return;
+    QMap<QByteArray, Detached>::iterator it = m_detached.begin();
+    while (it != m_detached.end()) {
+        ReplayFrame frame;
+        frame.opcode = opcode;
+        frame.payload = (it->capabilities & Protocol::Utf8Text) ? payload : legacyPayload;
+        if (m_resumes->append(it.key(), frame)) {
+            ++it;
+            continue;
+        }
+        // resuming would lose frames, better to say the game went on without it
+        qDebug("%s missed too much to resume", qPrintable(it->playerName));
+        removePlayer(it->playerName);
+        it = m_detached.erase(it);
+    }
+    if (m_detached.isEmpty())
+        m_expiryTimer->stop();
+}
+
+void ServerWorker::onSessionMessage(ServerSession* session, QString message)
+{
+    emit messageRead(session->otherPlayerName(), message);
+}
+
+void ServerWorker::onSessionData(ServerSession* session, QByteArray data)
+{
+    emit dataRead(session->otherPlayerName(), data);
+}
+
+void ServerWorker::onSessionUnreliable(ServerSession* session, QByteArray data)
+{
+    emit unreliableRead(session->otherPlayerName(), data);
+}
+
+void ServerWorker::onSessionInput(ServerSession* session, QByteArray payload)
+{
+    emit inputRead(session->otherPlayerName(), payload);
+}
+
+void ServerWorker::onSessionLatency(ServerSession* session, QVariantMap statistics)
+{
+    emit latencyUpdated(session->otherPlayerName(), statistics);
+}
+
+void ServerWorker::onSessionCompression(ServerSession* session, QVariantMap statistics)
+{
+    emit compressionUpdated(session->otherPlayerName(), statistics);
+}
+
+void ServerWorker::onSessionCongestion(ServerSession* session, bool congested)
+{
+    emit congestionChanged(session->otherPlayerName(), congested);
+}
+
+void ServerWorker::onSessionStatistics(ServerSession* session, NetworkStatistics statistics)
+{
+    emit statisticsUpdated(session->otherPlayerName(), statistics);
+}
+
+void ServerWorker::onSessionSendProgress(ServerSession* session, qint64 bytesSent, qint64 bytesTotal)
+{
+    emit sendProgress(session->otherPlayerName(), bytesSent, bytesTotal);
+}
+
+void ServerWorker::onSessionReceiveProgress(ServerSession* session, qint64 bytesReceived, qint64 bytesTotal)
+{
+    emit receiveProgress(session->otherPlayerName(), bytesReceived, bytesTotal);
+}
+
+void ServerWorker::sendMessage(QString message)
+{
+    // encode once per text encoding, every joined peer using it gets the same
+    // implicitly shared block
+    SharedPayload utf8(Protocol::encodeText(message, Protocol::Utf8Text));
+    SharedPayload legacy;
+    foreach (ServerSession* session, m_sessions) {
+        if (!session->isJoined())
+            continue;
+        if (session->capabilities() & Protocol::Utf8Text) {
+            session->sendPayload(Protocol::Message, &utf8);
+        } else {
+            if (legacy.payload.isNull())
+                legacy.payload = Protocol::encodeText(message, 0);
+            session->sendPayload(Protocol::Message, &legacy);
+        }
+    }
+    if (!m_detached.isEmpty()) {
+        if (legacy.payload.isNull())
+            legacy.payload = Protocol::encodeText(message, 0);
+        appendDetached(Protocol::Message, utf8.payload, legacy.payload);
+    }
+}
+
+void ServerWorker::sendData(const QByteArray& data)
+{
+    // opaque bytes need no per-peer encoding, one block serves everybody
+    SharedPayload shared(data);
+    foreach (ServerSession* session, m_sessions) {
+        if (session->isJoined())
+            session->sendPayload(Protocol::Data, &shared);
+    }
+    appendDetached(Protocol::Data, data, data);
+}
+
+void ServerWorker::sendUnreliable(const QByteArray& data)
+{
+    foreach (ServerSession* session, m_sessions) {
+        if (session->isJoined())
+            session->sendUnreliable(data);
+    }
+}
+
+void ServerWorker::publishSnapshot(quint32 id, const StateTable& state)
+{
+    // sessions that acknowledged the same snapshot share one encoding
+    m_snapshots.add(id, state);
+    QHash<quint32, SharedPayload> payloads;
+    foreach (ServerSession* session, m_sessions) {
+        if (!session->isJoined())
+            continue;
+        const quint32 base = session->acknowledgedSnapshot();
+        if (!payloads.contains(base)) {
+            payloads.insert(base, SharedPayload(m_snapshots.encode(id, base)));
+            TRACE(Replication, SnapshotPublished, id, payloads.value(base).payload.size());
+        }
+        session->sendPayload(Protocol::Snapshot, &payloads[base]);
+    }
+}
+
+void ServerWorker::sendTick(const QByteArray& payload)
+{
+    SharedPayload shared(payload);
+    TRACE(Lockstep, TickSent, payload.size(), 0);
+    foreach (ServerSession* session, m_sessions) {
+        if (session->isJoined())
+            session->sendPayload(Protocol::TickBatch, &shared);
+    }
+    appendDetached(Protocol::TickBatch, payload, payload);
+}
+
+void ServerWorker::ping()
+{
+    foreach (ServerSession* session, m_sessions) {
+        if (session->isJoined())
+            session->ping();
+    }
+}
+
+void ServerWorker::close()
+{
+    // parked players leave with the server
+    QMap<QByteArray, Detached>::const_iterator it = m_detached.constBegin();
+    for (; it != m_detached.constEnd(); ++it) {
+        ResumeState state;
+        if (m_resumes && m_resumes->take(it.key(), &state))
+            removePlayer(state.playerName);
+    }
+    m_detached.clear();
+    m_expiryTimer->stop();
+
+    // sessions may leave synchronously while disconnecting, iterate a copy
+    const QList<ServerSession*> sessions = m_sessions;
+    foreach (ServerSession* session, sessions) {
+        session->close();
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef SERVERWORKER_H
+#define SERVERWORKER_H
+
+#include <QObject>
+#include <QList>
+#include <QAtomicInt>
+#include <QVariantMap>
+#include <QMap>
+#include <QElapsedTimer>
+#include "connectionoptions.h"
+#include "snapshothistory.h"
+#include "include/networkstatistics.h"
+
+class ServerSession;
+class ResumeRegistry;
+class NameRegistry;
+class QTimer;
+
+// owns the sessions of one I/O thread, every call arrives queued from the
+// Server so no session is ever touched from another thread
+class ServerWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ServerWorker(QObject *parent = 0);
+    void setPassword(QString password);
+    void setPlayerName(QString playerName);
+    // where dropped sessions wait for their client, none disables resumption
+    void setResumeRegistry(ResumeRegistry* registry);
+    // names of the players on every worker
+    void setNameRegistry(NameRegistry* names);
+    // number of open sessions and of connections on their way to this
+    // worker, safe to call from any thread
+    int load() const;
+    // counts a connection before addConnection runs on the worker thread
+    void reserveConnection();
+
+public slots:
+    void addConnection(int socketDescriptor);
+    void setOptions(const ConnectionOptions& options);
+    void sendMessage(QString message);
+    void sendData(const QByteArray& data);
+    void sendUnreliable(const QByteArray& data);
+    void publishSnapshot(quint32 id, const StateTable& state);
+    void sendTick(const QByteArray& payload);
+    void ping();
+    void close();
+
+signals:
+    void playerConnected(QString playerName);
+    void playerDisconnected(QString playerName);
+    void messageRead(QString playerName, QString message);
+    void dataRead(QString playerName, QByteArray data);
+    void unreliableRead(QString playerName, QByteArray data);
+    void inputRead(QString playerName, QByteArray payload);
+    void pong(int msecs);
+    void latencyUpdated(QString playerName, QVariantMap statistics);
+    void compressionUpdated(QString playerName, QVariantMap statistics);
+    void congestionChanged(QString playerName, bool congested);
+    void statisticsUpdated(QString playerName, NetworkStatistics statistics);
+    void sendProgress(QString playerName, qint64 bytesSent, qint64 bytesTotal);
+    void receiveProgress(QString playerName, qint64 bytesReceived, qint64 bytesTotal);
+
+private slots:
+    void onSessionJoined(ServerSession* session);
+    void onSessionLeft(ServerSession* session);
+    void onSessionMessage(ServerSession* session, QString message);
+    void onSessionData(ServerSession* session, QByteArray data);
+    void onSessionUnreliable(ServerSession* session, QByteArray data);
+    void onSessionInput(ServerSession* session, QByteArray payload);
+    void onSessionResume(ServerSession* session, QByteArray token, quint64 received);
+    void expireDetached();
+    void onSessionLatency(ServerSession* session, QVariantMap statistics);
+    void onSessionCompression(ServerSession* session, QVariantMap statistics);
+    void onSessionCongestion(ServerSession* session, bool congested);
+    void onSessionStatistics(ServerSession* session, NetworkStatistics statistics);
+    void onSessionSendProgress(ServerSession* session, qint64 bytesSent, qint64 bytesTotal);
+    void onSessionReceiveProgress(ServerSession* session, qint64 bytesReceived, qint64 bytesTotal);
+
+private:
+    struct Detached
+    {
+        qint64 expiresAt;
+        quint32 capabilities;
+        QString playerName;
+    };
+
+    void sendFullSnapshot(ServerSession* session);
+    // broadcasts go into the replay of every session this worker parked,
+    // legacy peers get legacyPayload. One that missed too much is dropped
+    void appendDetached(quint8 opcode, const QByteArray& payload, const QByteArray& legacyPayload);
+    // frees the name for another player and reports the leave
+    void removePlayer(QString playerName);
+
+    QString m_player;
+    QString m_password;
+    QList<ServerSession*> m_sessions;
+    ConnectionOptions m_options;
+    SnapshotHistory m_snapshots;
+    QAtomicInt m_load;
+    ResumeRegistry* m_resumes;
+    NameRegistry* m_names;
+    // sessions this worker parked by token
+    QMap<QByteArray, Detached> m_detached;
+    QTimer* m_expiryTimer;
+    QElapsedTimer m_clock;
+};
+
+#endif // SERVERWORKER_H
@@ -0,0 +1,170 @@
+#include "snapshothistory.h"
+#include <QDataStream>
+
+// enough for a second of 30 Hz ticks without an acknowledgement
+static const int MaxSnapshots = 32;
+
+const quint32 SnapshotHistory::NoSnapshot;
+
+SnapshotHistory::SnapshotHistory()
+{
+}
+
+void SnapshotHistory::add(quint32 id, const StateTable& state)
+{
+    m_snapshots.append(qMakePair(id, state));
+    while (m_snapshots.size() > MaxSnapshots) {
+        m_snapshots.removeFirst();
+    }
+}
+
+bool SnapshotHistory::find(quint32 id, StateTable* state) const
+{
+    if (id == NoSnapshot)
+        return false;
+    for (int i = m_snapshots.size() - 1; i >= 0; --i) {
+        if (m_snapshots.at(i).first == id) {
+            *state = m_snapshots.at(i).second;
+            return true;
+        }
+    }
+    return false;
+}
+
+quint32 SnapshotHistory::latestId() const
+{
+    return m_snapshots.isEmpty() ? quint32(NoSnapshot) : m_snapshots.last().first;
+}
+
+// whether entry only appended fields to previous, which is what setFields
+// does. An entry removed and set again may list its fields in another order
+static bool extendsFields(const StateEntry& entry, const StateEntry& previous)
+{
+    if (previous.fields.size() > entry.fields.size())
+        return false;
+    for (int i = 0; i < previous.fields.size(); ++i) {
+        if (previous.fields.at(i) != entry.fields.at(i))
+            return false;
+    }
+    return true;
+}
+
+// layout: id, base id, removed keys, then per changed entry its key, field
+// count, names of fields the base lacks, a 32 bit mask word per 32 fields
+// and the values of the fields whose bit is set. An entry whose fields do
+// not extend the base's is sent as removed and then in full
+QByteArray SnapshotHistory::encode(quint32 id, quint32 baseId) const
+{
+    StateTable state;
+    StateTable base;
+    if (!find(id, &state))
+        return QByteArray();
+    if (!find(baseId, &base))
+        baseId = NoSnapshot;
+
+    QStringList removed;
+    StateTable::const_iterator it = base.constBegin();
+    for (; it != base.constEnd(); ++it) {
+        if (!state.contains(it.key()))
+            removed.append(it.key());
+    }
+
+    QList<QString> changed;
+    for (it = state.constBegin(); it != state.constEnd(); ++it) {
+        StateTable::const_iterator previous = base.constFind(it.key());
+        // untouched entries still share their lists with the base
+        if (previous == base.constEnd() || previous->fields != it->fields || previous->values != it->values)
+            changed.append(it.key());
+        if (previous != base.constEnd() && !extendsFields(*it, *previous)) {
+            removed.append(it.key());
+            base.remove(it.key());
+        }
+    }
+
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << id << baseId << removed << quint32(changed.size());
+    foreach (const QString& key, changed) {
+        const StateEntry entry = state.value(key);
+        const StateEntry previous = base.value(key);
+        const int count = entry.fields.size();
+        const int known = qMin(previous.fields.size(), count);
+        out << key << quint32(count);
+        for (int i = known; i < count; ++i) {
+            out << entry.fields.at(i);
+        }
+        for (int word = 0; word * 32 < count; ++word) {
+            quint32 mask = 0;
+            for (int bit = 0; bit < 32 && word * 32 + bit < count; ++bit) {
+                const int i = word * 32 + bit;
+                if (i >= known || entry.values.at(i) != previous.values.at(i))
+                    mask |= 1u << bit;
+            }
+            out << mask;
+        }
+        for (int i = 0; i < count; ++i) {
+            if (i >= known || entry.values.at(i) != previous.values.at(i))
+                out << entry.values.at(i);
+        }
+    }
+    return payload;
+}
+
+bool SnapshotHistory::apply(const QByteArray& payload, quint32* id, StateTable* state)
+{
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_4_6);
+    quint32 baseId = NoSnapshot;
+    QStringList removed;
+    quint32 changed = 0;
+    in >> *id >> baseId >> removed >> changed;
+    if (in.status() != QDataStream::Ok || *id == NoSnapshot)
+        return false;
+
+    StateTable result;
+    if (baseId != NoSnapshot && !find(baseId, &result)) {
+        qDebug("snapshot %u is based on unknown snapshot %u", *id, baseId);
+        return false;
+    }
+    foreach (const QString& key, removed) {
+        result.remove(key);
+    }
+
+    for (quint32 n = 0; n < changed && in.status() == QDataStream::Ok; ++n) {
+        QString key;
+        quint32 count = 0;
+        in >> key >> count;
+        StateEntry& entry = result[key];
+        const int known = entry.fields.size();
+        if (int(count) < known || count > quint32(payload.size()))
+            return false;
+        for (int i = known; i < int(count); ++i) {
+            QString field;
+            in >> field;
+            entry.fields.append(field);
+            entry.values.append(QVariant());
+        }
+        QList<quint32> masks;
+        for (int word = 0; word * 32 < int(count); ++word) {
+            quint32 mask = 0;
+            in >> mask;
+            masks.append(mask);
+        }
+        for (int i = 0; i < int(count); ++i) {
+            if (masks.at(i / 32) & (1u << (i % 32)))
+                in >> entry.values[i];
+        }
+    }
+    if (in.status() != QDataStream::Ok)
+        return false;
+
+    add(*id, result);
+    *state = result;
+    return true;
+}
+
+void SnapshotHistory::clear()
+{
+    m_snapshots.clear();
+}
@@ -0,0 +1,32 @@
+#ifndef SNAPSHOTHISTORY_H
+#define SNAPSHOTHISTORY_H
+
+#include <QList>
+#include <QPair>
+#include "statetable.h"
+
+// recent snapshots of the replicated state by id. The server encodes each
+// snapshot against the newest one a client acknowledged, the client keeps the
+// same window to have every possible base at hand
+class SnapshotHistory
+{
+public:
+    // ids start at one, zero stands for no snapshot and means a full one
+    static const quint32 NoSnapshot = 0;
+
+    SnapshotHistory();
+    void add(quint32 id, const StateTable& state);
+    bool find(quint32 id, StateTable* state) const;
+    quint32 latestId() const;
+    // only entries and fields that differ from the base go on the wire, a
+    // full snapshot when the base is unknown
+    QByteArray encode(quint32 id, quint32 baseId) const;
+    // fails when the payload is malformed or its base has been dropped
+    bool apply(const QByteArray& payload, quint32* id, StateTable* state);
+    void clear();
+
+private:
+    QList<QPair<quint32, StateTable> > m_snapshots;
+};
+
+#endif // SNAPSHOTHISTORY_H
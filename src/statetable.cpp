@@ -0,0 +1,24 @@
+#include "statetable.h"
+
+void StateEntry::setFields(const QVariantMap& map)
+{
+    QVariantMap::const_iterator it = map.constBegin();
+    for (; it != map.constEnd(); ++it) {
+        const int index = fields.indexOf(it.key());
+        if (index < 0) {
+            fields.append(it.key());
+            values.append(it.value());
+        } else if (values.at(index) != it.value()) {
+            values[index] = it.value();
+        }
+    }
+}
+
+QVariantMap StateEntry::toMap() const
+{
+    QVariantMap map;
+    for (int i = 0; i < fields.size(); ++i) {
+        map.insert(fields.at(i), values.at(i));
+    }
+    return map;
+}
@@ -0,0 +1,26 @@
+#ifndef STATETABLE_H
+#define STATETABLE_H
+
+#include <QHash>
+#include <QMetaType>
+#include <QStringList>
+#include <QVariantList>
+#include <QVariantMap>
+
+// one replicated object, fields keep the index they got when first set so
+// snapshots can address them with a bitmask
+struct StateEntry
+{
+    QStringList fields;
+    QVariantList values;
+
+    // updates the given fields and appends unknown ones, others stay as they are
+    void setFields(const QVariantMap& map);
+    QVariantMap toMap() const;
+};
+
+typedef QHash<QString, StateEntry> StateTable;
+
+Q_DECLARE_METATYPE(StateTable)
+
+#endif // STATETABLE_H
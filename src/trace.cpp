@@ -0,0 +1,159 @@
+#include "trace.h"
+#include "protocol.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include <QThread>
+
+QAtomicInt Trace::enabledCategories;
+
+namespace {
+
+// power of two, indexes wrap with a mask
+const int Capacity = 16384;
+
+struct Record
+{
+    // index + 1 once the fields are complete, zero while they are written
+    QAtomicInt sequence;
+    quint16 category;
+    quint16 event;
+    qint64 thread;
+    qint64 nsecs;
+    qint64 args[2];
+};
+
+struct Buffer
+{
+    Buffer()
+    {
+        timer.start();
+        // categories can be switched on without touching the application
+        Trace::enabledCategories = qgetenv("BATTLEQT_TRACE").toInt(0, 0);
+    }
+    QElapsedTimer timer;
+    QAtomicInt next;
+    QAtomicInt first;
+    Record records[Capacity];
+};
+
+// set up while the library loads, before any network thread exists
+Buffer buffer;
+
+struct EventInfo
+{
+    // B and E open and close a slice of the same name on one thread
+    char phase;
+    const char* name;
+    const char* args[2];
+};
+
+const EventInfo events[Trace::EventCount] = {
+    { 'i', "frameSent", { "opcode", "bytes" } },
+    { 'i', "frameReceived", { "opcode", "bytes" } },
+    { 'B', "read", { "available", 0 } },
+    { 'E', "read", { "frames", 0 } },
+    { 'i', "sessionJoined", { "capabilities", 0 } },
+    { 'i', "sessionLeft", { 0, 0 } },
+    { 'i', "authFailed", { 0, 0 } },
+    { 'i', "snapshotPublished", { "id", "bytes" } },
+    { 'i', "snapshotApplied", { "id", "bytes" } },
+    { 'i', "tickSent", { "bytes", 0 } },
+    { 'i', "tickReceived", { "bytes", 0 } },
+    { 'i', "congestionBegin", { "queued", 0 } },
+    { 'i', "congestionEnd", { "queued", 0 } },
+    { 'i', "staleStateDropped", { "bytes", 0 } }
+};
+
+const char* categoryName(int category)
+{
+    switch (category) {
+    case Trace::Frames: return "frames";
+    case Trace::Sessions: return "sessions";
+    case Trace::Replication: return "replication";
+    case Trace::Lockstep: return "lockstep";
+    case Trace::Congestion: return "congestion";
+    }
+    return "other";
+}
+
+}
+
+void Trace::setCategories(int categories)
+{
+    enabledCategories = categories;
+}
+
+void Trace::record(Category category, Event event, qint64 arg0, qint64 arg1)
+{
+    // claiming a slot is the only shared write, a full buffer overwrites the
+    // oldest records
+    const int index = buffer.next.fetchAndAddRelaxed(1);
+    Record& record = buffer.records[index & (Capacity - 1)];
+    record.sequence.fetchAndStoreRelaxed(0);
+    record.category = category;
+    record.event = event;
+    record.thread = qint64(quintptr(QThread::currentThreadId()));
+    record.nsecs = buffer.timer.nsecsElapsed();
+    record.args[0] = arg0;
+    record.args[1] = arg1;
+    record.sequence.fetchAndStoreRelease(index + 1);
+}
+
+void Trace::clear()
+{
+    buffer.first = int(buffer.next);
+}
+
+bool Trace::writeFile(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        qDebug("cannot write trace to %s", qPrintable(fileName));
+        return false;
+    }
+
+    const int end = buffer.next;
+    int begin = qMax(int(buffer.first), end - Capacity);
+    QTextStream out(&file);
+    out << "{\"traceEvents\":[";
+    bool separator = false;
+    for (int index = begin; index != end; ++index) {
+        Record& slot = buffer.records[index & (Capacity - 1)];
+        if (slot.sequence.fetchAndAddAcquire(0) != index + 1)
+            continue;
+        Record copy;
+        copy.category = slot.category;
+        copy.event = slot.event;
+        copy.thread = slot.thread;
+        copy.nsecs = slot.nsecs;
+        copy.args[0] = slot.args[0];
+        copy.args[1] = slot.args[1];
+        // overwritten while copying
+        if (slot.sequence.fetchAndAddAcquire(0) != index + 1 || copy.event >= EventCount)
+            continue;
+
+        const EventInfo& info = events[copy.event];
+        out << (separator ? ",\n" : "\n");
+        separator = true;
+        out << "{\"name\":\"" << info.name << "\",\"cat\":\"" << categoryName(copy.category)
+            << "\",\"ph\":\"" << info.phase << "\",\"pid\":1,\"tid\":" << copy.thread
+            << ",\"ts\":" << QString::number(copy.nsecs / 1000.0, 'f', 3);
+        if (info.phase == 'i')
+            out << ",\"s\":\"t\"";
+        out << ",\"args\":{";
+        for (int i = 0; i < 2 && info.args[i]; ++i) {
+            if (i)
+                out << ',';
+            out << '"' << info.args[i] << "\":";
+            if (qstrcmp(info.args[i], "opcode") == 0) {
+                out << '"' << Protocol::opcodeName(quint8(copy.args[i])) << '"';
+            } else {
+                out << copy.args[i];
+            }
+        }
+        out << "}}";
+    }
+    out << "\n]}\n";
+    return file.error() == QFile::NoError;
+}
@@ -0,0 +1,67 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QtGlobal>
+#include <QAtomicInt>
+
+class QString;
+
+// binary events with timestamps recorded into a fixed ring buffer, exported
+// in the Chrome trace event format (chrome://tracing, Perfetto).
+// Build with BATTLEQT_NO_TRACE to compile every TRACE() out; otherwise a
+// disabled category costs one load and a branch.
+namespace Trace
+{
+    enum Category {
+        Frames = 0x01,
+        Sessions = 0x02,
+        Replication = 0x04,
+        Lockstep = 0x08,
+        Congestion = 0x10,
+        AllCategories = 0xff
+    };
+
+    // names and argument names are listed in trace.cpp, keep the order
+    enum Event {
+        FrameSent,          // opcode, bytes
+        FrameReceived,      // opcode, bytes
+        ReadBegin,          // bytes available
+        ReadEnd,            // frames parsed
+        SessionJoined,      // capabilities
+        SessionLeft,
+        AuthFailed,
+        SnapshotPublished,  // id, bytes
+        SnapshotApplied,    // id, bytes
+        TickSent,           // bytes
+        TickReceived,       // bytes
+        CongestionBegin,    // bytes queued
+        CongestionEnd,      // bytes queued
+        StaleStateDropped,  // bytes
+        EventCount
+    };
+
+    extern QAtomicInt enabledCategories;
+
+    inline bool isEnabled(Category category)
+    {
+        return int(enabledCategories) & category;
+    }
+
+    void setCategories(int categories);
+    void record(Category category, Event event, qint64 arg0 = 0, qint64 arg1 = 0);
+    // writes what the ring buffer holds, oldest first, and keeps recording
+    bool writeFile(const QString& fileName);
+    void clear();
+}
+
+#ifdef BATTLEQT_NO_TRACE
+#define TRACE(category, event, arg0, arg1) do {} while (0)
+#else
+#define TRACE(category, event, arg0, arg1) \
+    do { \
+        if (Trace::isEnabled(Trace::category)) \
+            Trace::record(Trace::category, Trace::event, (arg0), (arg1)); \
+    } while (0)
+#endif
+
+#endif // TRACE_H
@@ -0,0 +1,126 @@
+#include "unreliablechannel.h"
+#include <QUdpSocket>
+#include <QTimer>
+#include <QtEndian>
+
+// token and sequence number, both big endian
+static const int HeaderSize = 2 * sizeof(quint32);
+
+// sequence zero is the hello and its answer, never application data
+static const quint32 HelloSequence = 0;
+
+static const int HelloInterval = 250;
+static const int MaxHelloAttempts = 20;
+
+UnreliableChannel::UnreliableChannel(quint32 token, QObject *parent) :
+    QObject(parent),
+    m_socket(new QUdpSocket(this)),
+    m_helloTimer(new QTimer(this)),
+    m_peerPort(0),
+    m_token(token),
+    m_sendSequence(HelloSequence),
+    m_receiveSequence(HelloSequence),
+    m_helloAttempts(0),
+    m_learnPeer(true),
+    m_peerKnown(false),
+    m_ready(false)
+{
+    connect(m_socket, SIGNAL(readyRead()), this, SLOT(readDatagrams()));
+    connect(m_helloTimer, SIGNAL(timeout()), this, SLOT(sendHello()));
+}
+
+bool UnreliableChannel::bind()
+{
+    return m_socket->bind(QHostAddress::Any, 0);
+}
+
+quint16 UnreliableChannel::localPort() const
+{
+    return m_socket->localPort();
+}
+
+void UnreliableChannel::connectToPeer(const QHostAddress& address, quint16 port)
+{
+    m_peer = address;
+    m_peerPort = port;
+    m_learnPeer = false;
+    m_peerKnown = true;
+    m_helloAttempts = 0;
+    sendHello();
+    m_helloTimer->start(HelloInterval);
+}
+
+bool UnreliableChannel::isReady() const
+{
+    return m_ready;
+}
+
+void UnreliableChannel::send(const QByteArray& payload)
+{
+    if (!m_ready)
+        return;
+    ++m_sendSequence;
+    if (m_sendSequence == HelloSequence)
+        ++m_sendSequence;
+    writeDatagram(m_sendSequence, payload);
+}
+
+void UnreliableChannel::sendHello()
+{
+    if (m_ready || ++m_helloAttempts > MaxHelloAttempts) {
+        m_helloTimer->stop();
+        return;
+    }
+    writeDatagram(HelloSequence, QByteArray());
+}
+
+void UnreliableChannel::writeDatagram(quint32 sequence, const QByteArray& payload)
+{
+    QByteArray datagram(HeaderSize, Qt::Uninitialized);
+    qToBigEndian(m_token, reinterpret_cast<uchar*>(datagram.data()));
+    qToBigEndian(sequence, reinterpret_cast<uchar*>(datagram.data() + sizeof(quint32)));
+    datagram.append(payload);
+    m_socket->writeDatagram(datagram, m_peer, m_peerPort);
+}
+
+void UnreliableChannel::readDatagrams()
+{
+    while (m_socket->hasPendingDatagrams()) {
+        QByteArray datagram(int(m_socket->pendingDatagramSize()), Qt::Uninitialized);
+        QHostAddress sender;
+        quint16 senderPort = 0;
+        m_socket->readDatagram(datagram.data(), datagram.size(), &sender, &senderPort);
+        if (datagram.size() < HeaderSize)
+            continue;
+
+        const uchar* header = reinterpret_cast<const uchar*>(datagram.constData());
+        if (qFromBigEndian<quint32>(header) != m_token)
+            continue;
+        const quint32 sequence = qFromBigEndian<quint32>(header + sizeof(quint32));
+
+        if (!m_peerKnown) {
+            if (sequence != HelloSequence)
+                continue;
+            m_peer = sender;
+            m_peerPort = senderPort;
+            m_peerKnown = true;
+        } else if (sender != m_peer || senderPort != m_peerPort) {
+            continue;
+        }
+
+        if (sequence == HelloSequence) {
+            // answer every hello, the client retries until one gets through
+            if (m_learnPeer)
+                writeDatagram(HelloSequence, QByteArray());
+            m_ready = true;
+            m_helloTimer->stop();
+            continue;
+        }
+
+        // serial number arithmetic, survives wrap around
+        if (qint32(sequence - m_receiveSequence) <= 0)
+            continue;
+        m_receiveSequence = sequence;
+        emit datagramRead(datagram.mid(HeaderSize));
+    }
+}
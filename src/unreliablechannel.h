@@ -0,0 +1,50 @@
+#ifndef UNRELIABLECHANNEL_H
+#define UNRELIABLECHANNEL_H
+
+#include <QObject>
+#include <QHostAddress>
+
+class QUdpSocket;
+class QTimer;
+
+// UDP side channel paired with a TCP connection for high rate state. Every
+// datagram carries the token handed out over TCP and a sequence number, late
+// arrivals are dropped instead of stalling everything behind them
+class UnreliableChannel : public QObject
+{
+    Q_OBJECT
+public:
+    explicit UnreliableChannel(quint32 token, QObject *parent = 0);
+    bool bind();
+    quint16 localPort() const;
+    // client side: the peer is known, keep saying hello until it answers
+    void connectToPeer(const QHostAddress& address, quint16 port);
+    bool isReady() const;
+    void send(const QByteArray& payload);
+
+signals:
+    void datagramRead(QByteArray payload);
+
+private slots:
+    void readDatagrams();
+    void sendHello();
+
+private:
+    void writeDatagram(quint32 sequence, const QByteArray& payload);
+
+    QUdpSocket* m_socket;
+    QTimer* m_helloTimer;
+    QHostAddress m_peer;
+    quint16 m_peerPort;
+    quint32 m_token;
+    quint32 m_sendSequence;
+    quint32 m_receiveSequence;
+    int m_helloAttempts;
+    bool m_learnPeer;
+    // server side the peer is whoever sends the first valid hello, from
+    // then on datagrams from anywhere else are dropped
+    bool m_peerKnown;
+    bool m_ready;
+};
+
+#endif // UNRELIABLECHANNEL_H
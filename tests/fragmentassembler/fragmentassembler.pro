@@ -0,0 +1,4 @@
+TARGET = tst_fragmentassembler
+include(../tests.pri)
+
+SOURCES += tst_fragmentassembler.cpp
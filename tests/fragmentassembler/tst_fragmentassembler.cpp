@@ -0,0 +1,188 @@
+#include <QtTest/QtTest>
+#include "fragmentassembler.h"
+
+class TestFragmentAssembler : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void singleStream();
+    void interleavedStreams();
+    void unknownStream();
+    void duplicateBegin();
+    void overlongStream();
+    void disallowedOpcode();
+    void oversizeTransfer();
+    void tooManyStreams();
+    void tooManyBytes();
+    void clear();
+};
+
+// the layouts FrameWriter produces
+static Protocol::Frame beginFrame(quint32 stream, quint8 opcode, quint32 size, const QByteArray& data)
+{
+    Protocol::Frame frame;
+    frame.opcode = Protocol::FragmentBegin;
+    Protocol::writeVarint(&frame.payload, stream);
+    frame.payload.append(char(opcode));
+    Protocol::writeVarint(&frame.payload, size);
+    frame.payload.append(data);
+    return frame;
+}
+
+static Protocol::Frame dataFrame(quint32 stream, const QByteArray& data)
+{
+    Protocol::Frame frame;
+    frame.opcode = Protocol::FragmentData;
+    Protocol::writeVarint(&frame.payload, stream);
+    frame.payload.append(data);
+    return frame;
+}
+
+void TestFragmentAssembler::singleStream()
+{
+    FragmentAssembler assembler;
+    Protocol::Frame complete;
+    qint64 received = 0;
+    qint64 total = 0;
+
+    QVERIFY(!assembler.addFragment(beginFrame(1, Protocol::Data, 9, "abc"), &complete, &received, &total));
+    QCOMPARE(received, qint64(3));
+    QCOMPARE(total, qint64(9));
+    QVERIFY(!assembler.addFragment(dataFrame(1, "def"), &complete, &received, &total));
+    QVERIFY(assembler.addFragment(dataFrame(1, "ghi"), &complete, &received, &total));
+    QVERIFY(!assembler.hasError());
+    QCOMPARE(int(complete.opcode), int(Protocol::Data));
+    QCOMPARE(complete.payload, QByteArray("abcdefghi"));
+    QCOMPARE(received, total);
+}
+
+void TestFragmentAssembler::interleavedStreams()
+{
+    FragmentAssembler assembler;
+    Protocol::Frame complete;
+    qint64 received = 0;
+    qint64 total = 0;
+
+    QVERIFY(!assembler.addFragment(beginFrame(1, Protocol::Message, 4, "ab"), &complete, &received, &total));
+    QVERIFY(!assembler.addFragment(beginFrame(2, Protocol::Data | Protocol::CompressedFlag, 4, "12"),
+                                   &complete, &received, &total));
+    QVERIFY(assembler.addFragment(dataFrame(2, "34"), &complete, &received, &total));
+    QCOMPARE(int(complete.opcode), int(Protocol::Data | Protocol::CompressedFlag));
+    QCOMPARE(complete.payload, QByteArray("1234"));
+    QVERIFY(assembler.addFragment(dataFrame(1, "cd"), &complete, &received, &total));
+    QCOMPARE(int(complete.opcode), int(Protocol::Message));
+    QCOMPARE(complete.payload, QByteArray("abcd"));
+    QVERIFY(!assembler.hasError());
+}
+
+void TestFragmentAssembler::unknownStream()
+{
+    FragmentAssembler assembler;
+    Protocol::Frame complete;
+    qint64 received = 0;
+    qint64 total = 0;
+    QVERIFY(!assembler.addFragment(dataFrame(7, "x"), &complete, &received, &total));
+    QVERIFY(assembler.hasError());
+}
+
+void TestFragmentAssembler::duplicateBegin()
+{
+    FragmentAssembler assembler;
+    Protocol::Frame complete;
+    qint64 received = 0;
+    qint64 total = 0;
+    QVERIFY(!assembler.addFragment(beginFrame(1, Protocol::Data, 10, "x"), &complete, &received, &total));
+    QVERIFY(!assembler.addFragment(beginFrame(1, Protocol::Data, 10, "x"), &complete, &received, &total));
+    QVERIFY(assembler.hasError());
+}
+
+void TestFragmentAssembler::overlongStream()
+{
+    FragmentAssembler assembler;
+    Protocol::Frame complete;
+    qint64 received = 0;
+    qint64 total = 0;
+    QVERIFY(!assembler.addFragment(beginFrame(1, Protocol::Data, 4, "abc"), &complete, &received, &total));
+    QVERIFY(!assembler.addFragment(dataFrame(1, "de"), &complete, &received, &total));
+    QVERIFY(assembler.hasError());
+}
+
+void TestFragmentAssembler::disallowedOpcode()
+{
+    // control frames are never streamed
+    FragmentAssembler assembler;
+    Protocol::Frame complete;
+    qint64 received = 0;
+    qint64 total = 0;
+    QVERIFY(!assembler.addFragment(beginFrame(1, Protocol::Ping, 4, "ab"), &complete, &received, &total));
+    QVERIFY(assembler.hasError());
+}
+
+void TestFragmentAssembler::oversizeTransfer()
+{
+    FragmentAssembler assembler;
+    Protocol::Frame complete;
+    qint64 received = 0;
+    qint64 total = 0;
+    QVERIFY(!assembler.addFragment(beginFrame(1, Protocol::Data, Protocol::MaxTransferSize + 1, "ab"),
+                                   &complete, &received, &total));
+    QVERIFY(assembler.hasError());
+}
+
+void TestFragmentAssembler::tooManyStreams()
+{
+    FragmentAssembler assembler;
+    Protocol::Frame complete;
+    qint64 received = 0;
+    qint64 total = 0;
+    quint32 stream = 1;
+    for (; stream <= quint32(Protocol::MaxOpenStreams); ++stream) {
+        QVERIFY(!assembler.addFragment(beginFrame(stream, Protocol::Data, 4, "ab"), &complete, &received, &total));
+    }
+    QVERIFY(!assembler.hasError());
+
+    // a finished stream makes room for another
+    QVERIFY(assembler.addFragment(dataFrame(1, "cd"), &complete, &received, &total));
+    QVERIFY(!assembler.addFragment(beginFrame(stream++, Protocol::Data, 4, "ab"), &complete, &received, &total));
+    QVERIFY(!assembler.hasError());
+    QVERIFY(!assembler.addFragment(beginFrame(stream, Protocol::Data, 4, "ab"), &complete, &received, &total));
+    QVERIFY(assembler.hasError());
+}
+
+void TestFragmentAssembler::tooManyBytes()
+{
+    // the declared sizes count, nothing of them has to arrive
+    FragmentAssembler assembler;
+    Protocol::Frame complete;
+    qint64 received = 0;
+    qint64 total = 0;
+    QVERIFY(!assembler.addFragment(beginFrame(1, Protocol::Data, Protocol::MaxTransferSize, "ab"),
+                                   &complete, &received, &total));
+    QVERIFY(!assembler.addFragment(beginFrame(2, Protocol::Data, Protocol::MaxTransferSize, "ab"),
+                                   &complete, &received, &total));
+    QVERIFY(!assembler.hasError());
+    QVERIFY(!assembler.addFragment(beginFrame(3, Protocol::Data, 4, "ab"), &complete, &received, &total));
+    QVERIFY(assembler.hasError());
+}
+
+void TestFragmentAssembler::clear()
+{
+    FragmentAssembler assembler;
+    Protocol::Frame complete;
+    qint64 received = 0;
+    qint64 total = 0;
+    QVERIFY(!assembler.addFragment(beginFrame(1, Protocol::Data, 4, "ab"), &complete, &received, &total));
+    QVERIFY(!assembler.addFragment(dataFrame(9, "x"), &complete, &received, &total));
+    QVERIFY(assembler.hasError());
+
+    // streams cut off by a reconnect are dropped with the error
+    assembler.clear();
+    QVERIFY(!assembler.hasError());
+    QVERIFY(!assembler.addFragment(dataFrame(1, "cd"), &complete, &received, &total));
+    QVERIFY(assembler.hasError());
+}
+
+QTEST_MAIN(TestFragmentAssembler)
+
+#include "tst_fragmentassembler.moc"
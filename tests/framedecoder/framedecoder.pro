@@ -0,0 +1,4 @@
+TARGET = tst_framedecoder
+include(../tests.pri)
+
+SOURCES += tst_framedecoder.cpp
@@ -0,0 +1,232 @@
+#include <QtTest/QtTest>
+#include "framedecoder.h"
+
+class TestFrameDecoder : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void wholeFrames();
+    void emptyPayload();
+    void splitFrames_data();
+    void splitFrames();
+    void partialHeader();
+    void compressedOpcode();
+    void varintOverflow();
+    void oversizeLength();
+    void invalidOpcode_data();
+    void invalidOpcode();
+    void reset();
+};
+
+// several frames back to back, one with a two byte length
+static QByteArray stream()
+{
+    return FrameDecoder::encodeFrame(Protocol::Message, "hello")
+            + FrameDecoder::encodeFrame(Protocol::Ping)
+            + FrameDecoder::encodeFrame(Protocol::Message, QByteArray(300, 'x'))
+            + FrameDecoder::encodeFrame(Protocol::Pong, "pong");
+}
+
+static void checkStream(const QList<Protocol::Frame>& frames)
+{
+    QCOMPARE(frames.size(), 4);
+    QCOMPARE(int(frames.at(0).opcode), int(Protocol::Message));
+    QCOMPARE(frames.at(0).payload, QByteArray("hello"));
+    QCOMPARE(int(frames.at(1).opcode), int(Protocol::Ping));
+    QVERIFY(frames.at(1).payload.isEmpty());
+    QCOMPARE(int(frames.at(2).opcode), int(Protocol::Message));
+    QCOMPARE(frames.at(2).payload, QByteArray(300, 'x'));
+    QCOMPARE(int(frames.at(3).opcode), int(Protocol::Pong));
+    QCOMPARE(frames.at(3).payload, QByteArray("pong"));
+}
+
+void TestFrameDecoder::wholeFrames()
+{
+    QByteArray data = stream();
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    FrameDecoder decoder;
+    QList<Protocol::Frame> frames;
+    Protocol::Frame frame;
+    while (decoder.readFrame(&buffer, &frame)) {
+        frames.append(frame);
+    }
+    QVERIFY(!decoder.hasError());
+    QCOMPARE(buffer.bytesAvailable(), qint64(0));
+    checkStream(frames);
+}
+
+void TestFrameDecoder::emptyPayload()
+{
+    QByteArray data = FrameDecoder::encodeFrame(Protocol::Hello);
+    QCOMPARE(data.size(), 2);
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    FrameDecoder decoder;
+    Protocol::Frame frame;
+    QVERIFY(decoder.readFrame(&buffer, &frame));
+    QCOMPARE(int(frame.opcode), int(Protocol::Hello));
+    QVERIFY(frame.payload.isEmpty());
+    QVERIFY(!decoder.readFrame(&buffer, &frame));
+    QVERIFY(!decoder.hasError());
+}
+
+void TestFrameDecoder::splitFrames_data()
+{
+    QTest::addColumn<int>("chunk");
+    QTest::newRow("1 byte") << 1;
+    QTest::newRow("2 bytes") << 2;
+    QTest::newRow("3 bytes") << 3;
+    QTest::newRow("7 bytes") << 7;
+    QTest::newRow("100 bytes") << 100;
+}
+
+void TestFrameDecoder::splitFrames()
+{
+    // the stream arrives in pieces that cut through headers and payloads
+    QFETCH(int, chunk);
+    const QByteArray whole = stream();
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    FrameDecoder decoder;
+    QList<Protocol::Frame> frames;
+    Protocol::Frame frame;
+    for (int offset = 0; offset < whole.size(); offset += chunk) {
+        buffer.buffer().append(whole.mid(offset, chunk));
+        while (decoder.readFrame(&buffer, &frame)) {
+            frames.append(frame);
+        }
+        QVERIFY(!decoder.hasError());
+    }
+    checkStream(frames);
+}
+
+void TestFrameDecoder::partialHeader()
+{
+    // a length varint cut after its continuation byte
+    const QByteArray whole = FrameDecoder::encodeFrame(Protocol::Message, QByteArray(200, 'y'));
+    QByteArray data = whole.left(2);
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    FrameDecoder decoder;
+    Protocol::Frame frame;
+    QVERIFY(!decoder.readFrame(&buffer, &frame));
+    QVERIFY(!decoder.hasError());
+    QCOMPARE(buffer.bytesAvailable(), qint64(2));
+
+    buffer.buffer().append(whole.mid(2));
+    QVERIFY(decoder.readFrame(&buffer, &frame));
+    QCOMPARE(frame.payload, QByteArray(200, 'y'));
+}
+
+void TestFrameDecoder::compressedOpcode()
+{
+    QByteArray data = FrameDecoder::encodeFrame(Protocol::Data | Protocol::CompressedFlag, "zz");
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    FrameDecoder decoder;
+    Protocol::Frame frame;
+    QVERIFY(decoder.readFrame(&buffer, &frame));
+    QCOMPARE(int(frame.opcode), int(Protocol::Data | Protocol::CompressedFlag));
+    QCOMPARE(frame.payload, QByteArray("zz"));
+}
+
+void TestFrameDecoder::varintOverflow()
+{
+    // five continuation bytes and no end of the length
+    QByteArray data;
+    data.append(char(Protocol::Message));
+    data.append(QByteArray(5, char(0xff)));
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    FrameDecoder decoder;
+    Protocol::Frame frame;
+    QVERIFY(!decoder.readFrame(&buffer, &frame));
+    QVERIFY(decoder.hasError());
+}
+
+void TestFrameDecoder::oversizeLength()
+{
+    QByteArray data;
+    data.append(char(Protocol::Message));
+    Protocol::writeVarint(&data, Protocol::MaxPayloadSize + 1);
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    FrameDecoder decoder;
+    Protocol::Frame frame;
+    QVERIFY(!decoder.readFrame(&buffer, &frame));
+    QVERIFY(decoder.hasError());
+
+    // the largest allowed length is only waited for
+    QByteArray largest;
+    largest.append(char(Protocol::Message));
+    Protocol::writeVarint(&largest, Protocol::MaxPayloadSize);
+    QBuffer largestBuffer(&largest);
+    largestBuffer.open(QIODevice::ReadOnly);
+    FrameDecoder other;
+    QVERIFY(!other.readFrame(&largestBuffer, &frame));
+    QVERIFY(!other.hasError());
+}
+
+void TestFrameDecoder::invalidOpcode_data()
+{
+    QTest::addColumn<QByteArray>("data");
+
+    // legacy peers send a big endian quint16 length and a QDataStream
+    // string, the high byte of a short length is zero
+    QByteArray legacy;
+    QDataStream out(&legacy, QIODevice::WriteOnly);
+    out << quint16(12) << QString("hello!");
+    QTest::newRow("legacy") << legacy;
+    QTest::newRow("zero") << QByteArray(2, '\0');
+    QTest::newRow("unknown") << FrameDecoder::encodeFrame(Protocol::OpcodeCount, "x");
+    QTest::newRow("unknown compressed") << FrameDecoder::encodeFrame(0x7f | Protocol::CompressedFlag, "x");
+}
+
+void TestFrameDecoder::invalidOpcode()
+{
+    QFETCH(QByteArray, data);
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    FrameDecoder decoder;
+    Protocol::Frame frame;
+    QVERIFY(!decoder.readFrame(&buffer, &frame));
+    QVERIFY(decoder.hasError());
+    // broken for good, nothing more is taken from the device
+    const qint64 available = buffer.bytesAvailable();
+    QVERIFY(!decoder.readFrame(&buffer, &frame));
+    QCOMPARE(buffer.bytesAvailable(), available);
+}
+
+void TestFrameDecoder::reset()
+{
+    QByteArray broken(1, '\0');
+    QBuffer brokenBuffer(&broken);
+    brokenBuffer.open(QIODevice::ReadOnly);
+    FrameDecoder decoder;
+    Protocol::Frame frame;
+    QVERIFY(!decoder.readFrame(&brokenBuffer, &frame));
+    QVERIFY(decoder.hasError());
+
+    decoder.reset();
+    QVERIFY(!decoder.hasError());
+    QByteArray data = FrameDecoder::encodeFrame(Protocol::Ping);
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    QVERIFY(decoder.readFrame(&buffer, &frame));
+    QCOMPARE(int(frame.opcode), int(Protocol::Ping));
+}
+
+QTEST_MAIN(TestFrameDecoder)
+
+#include "tst_framedecoder.moc"
@@ -0,0 +1,4 @@
+TARGET = tst_framewriter
+include(../tests.pri)
+
+SOURCES += tst_framewriter.cpp
@@ -0,0 +1,97 @@
+#include <QtTest/QtTest>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include "framewriter.h"
+#include "framedecoder.h"
+#include "fragmentassembler.h"
+
+class TestFrameWriter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void sameClassInOrder_data();
+    void sameClassInOrder();
+
+private:
+    QList<Protocol::Frame> receive(int count);
+
+    QTcpServer* m_server;
+    QTcpSocket* m_sender;
+    QTcpSocket* m_receiver;
+};
+
+void TestFrameWriter::init()
+{
+    m_server = new QTcpServer(this);
+    QVERIFY(m_server->listen(QHostAddress::LocalHost));
+    m_sender = new QTcpSocket(this);
+    m_sender->connectToHost(QHostAddress::LocalHost, m_server->serverPort());
+    QVERIFY(m_sender->waitForConnected(5000));
+    QVERIFY(m_server->waitForNewConnection(5000));
+    m_receiver = m_server->nextPendingConnection();
+}
+
+void TestFrameWriter::cleanup()
+{
+    delete m_sender;
+    delete m_server;
+}
+
+// reads until count whole frames arrived, fragments put back together
+QList<Protocol::Frame> TestFrameWriter::receive(int count)
+{
+    FrameDecoder decoder;
+    FragmentAssembler assembler;
+    QList<Protocol::Frame> frames;
+    QTime timer;
+    timer.start();
+    while (frames.size() < count && timer.elapsed() < 5000) {
+        QTest::qWait(10);
+        Protocol::Frame frame;
+        while (decoder.readFrame(m_receiver, &frame)) {
+            if (frame.opcode != Protocol::FragmentBegin && frame.opcode != Protocol::FragmentData) {
+                frames.append(frame);
+                continue;
+            }
+            Protocol::Frame complete;
+            qint64 received = 0;
+            qint64 total = 0;
+            if (assembler.addFragment(frame, &complete, &received, &total))
+                frames.append(complete);
+        }
+    }
+    return frames;
+}
+
+void TestFrameWriter::sameClassInOrder_data()
+{
+    QTest::addColumn<int>("opcode");
+
+    QTest::newRow("bulk") << int(Protocol::Data);
+    QTest::newRow("realtime") << int(Protocol::TickBatch);
+}
+
+// a small payload sent after a fragmented one of its class must not overtake it
+void TestFrameWriter::sameClassInOrder()
+{
+    QFETCH(int, opcode);
+
+    FrameWriter writer(m_sender);
+    writer.setFragmentationEnabled(true);
+    const QByteArray large(5 * Protocol::FragmentSize, 'l');
+    writer.writeFrame(opcode, large);
+    writer.writeFrame(opcode, "small");
+
+    QList<Protocol::Frame> frames = receive(2);
+    QCOMPARE(frames.size(), 2);
+    QCOMPARE(int(frames.at(0).opcode), opcode);
+    QCOMPARE(frames.at(0).payload, large);
+    QCOMPARE(int(frames.at(1).opcode), opcode);
+    QCOMPARE(frames.at(1).payload, QByteArray("small"));
+}
+
+QTEST_MAIN(TestFrameWriter)
+#include "tst_framewriter.moc"
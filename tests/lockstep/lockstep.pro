@@ -0,0 +1,4 @@
+TARGET = tst_lockstep
+include(../tests.pri)
+
+SOURCES += tst_lockstep.cpp
@@ -0,0 +1,200 @@
+#include <QtTest/QtTest>
+#include "lockstep.h"
+
+class TestLockstep : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void waitsForEveryPlayer();
+    void predictsLatePlayer();
+    void inputsByTick();
+    void removedPlayerIsNotWaitedFor();
+    void removedHostIsReplaced();
+    void checksums();
+    void inputRoundTrip();
+    void batchRoundTrip();
+};
+
+static QList<QByteArray> inputs(const QByteArray& input)
+{
+    QList<QByteArray> list;
+    list.append(input);
+    return list;
+}
+
+void TestLockstep::waitsForEveryPlayer()
+{
+    LockstepCoordinator lockstep;
+    lockstep.addPlayer("host");
+    lockstep.addPlayer("guest");
+
+    lockstep.addInput("host", 1, inputs("h1"));
+    QVERIFY(lockstep.advance().isEmpty());
+    QCOMPARE(lockstep.waitingFor(), QStringList() << "guest");
+
+    lockstep.addInput("guest", 1, inputs("g1"));
+    const QList<TickBatch> batches = lockstep.advance();
+    QCOMPARE(batches.size(), 1);
+    const TickBatch& batch = batches.first();
+    QCOMPARE(batch.tick, quint32(1));
+    QCOMPARE(batch.players.size(), 2);
+    QCOMPARE(batch.inputs.at(batch.players.indexOf("host")), inputs("h1"));
+    QCOMPARE(batch.inputs.at(batch.players.indexOf("guest")), inputs("g1"));
+    QVERIFY(batch.predicted.isEmpty());
+    QCOMPARE(lockstep.nextTick(), quint32(2));
+}
+
+void TestLockstep::predictsLatePlayer()
+{
+    LockstepCoordinator lockstep;
+    lockstep.setPredictionDelay(2);
+    lockstep.addPlayer("host");
+    lockstep.addPlayer("guest");
+    lockstep.addInput("host", 1, inputs("h1"));
+    lockstep.addInput("guest", 1, inputs("g1"));
+    QCOMPARE(lockstep.advance().size(), 1);
+
+    // the guest falls silent, the host keeps ticking
+    lockstep.addInput("host", 2, inputs("h2"));
+    QVERIFY(lockstep.advance().isEmpty());
+    lockstep.addInput("host", 3, inputs("h3"));
+    lockstep.addInput("host", 4, inputs("h4"));
+    const QList<TickBatch> batches = lockstep.advance();
+    QVERIFY(!batches.isEmpty());
+    const TickBatch& batch = batches.first();
+    QCOMPARE(batch.tick, quint32(2));
+    QCOMPARE(batch.predicted, QStringList() << "guest");
+    // the guest's last inputs are repeated
+    QCOMPARE(batch.inputs.at(batch.players.indexOf("guest")), inputs("g1"));
+
+    // the late inputs for tick 2 are dropped, the ones for the next open
+    // tick count
+    const quint32 next = lockstep.nextTick();
+    lockstep.addInput("guest", 2, inputs("late"));
+    lockstep.addInput("guest", next, inputs("g"));
+    QVERIFY(!lockstep.waitingFor().contains("guest"));
+}
+
+void TestLockstep::inputsByTick()
+{
+    LockstepCoordinator lockstep;
+    lockstep.addPlayer("host");
+    lockstep.addPlayer("guest");
+
+    // out of order, and the same tick twice
+    lockstep.addInput("guest", 2, inputs("g2"));
+    lockstep.addInput("guest", 1, inputs("g1"));
+    lockstep.addInput("guest", 1, inputs("again"));
+    lockstep.addInput("host", 1, inputs("h1"));
+    lockstep.addInput("host", 2, inputs("h2"));
+    const QList<TickBatch> batches = lockstep.advance();
+    QCOMPARE(batches.size(), 2);
+    QCOMPARE(batches.at(0).inputs.at(batches.at(0).players.indexOf("guest")), inputs("g1"));
+    QCOMPARE(batches.at(1).inputs.at(batches.at(1).players.indexOf("guest")), inputs("g2"));
+
+    // far ahead of the next tick
+    lockstep.addInput("guest", 100000, inputs("future"));
+    lockstep.addInput("host", 3, inputs("h3"));
+    QVERIFY(lockstep.advance().isEmpty());
+    QCOMPARE(lockstep.waitingFor(), QStringList() << "guest");
+}
+
+void TestLockstep::removedPlayerIsNotWaitedFor()
+{
+    LockstepCoordinator lockstep;
+    lockstep.addPlayer("host");
+    lockstep.addPlayer("guest");
+    lockstep.addInput("host", 1, inputs("h1"));
+    QVERIFY(lockstep.advance().isEmpty());
+
+    lockstep.removePlayer("guest");
+    const QList<TickBatch> batches = lockstep.advance();
+    QCOMPARE(batches.size(), 1);
+    QCOMPARE(batches.first().players, QStringList() << "host");
+}
+
+void TestLockstep::removedHostIsReplaced()
+{
+    LockstepCoordinator lockstep;
+    lockstep.setPredictionDelay(1);
+    lockstep.addPlayer("host");
+    lockstep.addPlayer("guest");
+    lockstep.addPlayer("third");
+    lockstep.addInput("host", 1, inputs("h"));
+    lockstep.addInput("guest", 1, inputs("g"));
+    lockstep.addInput("third", 1, inputs("t"));
+    QCOMPARE(lockstep.advance().size(), 1);
+
+    lockstep.removePlayer("host");
+    // guest is the reference now
+    QVERIFY(lockstep.addChecksum("third", 1, 0xbad).isEmpty());
+    QCOMPARE(lockstep.addChecksum("guest", 1, 0x600d), QStringList() << "third");
+
+    // and its backlog decides when third is predicted
+    lockstep.addInput("guest", 2, inputs("g2"));
+    QVERIFY(lockstep.advance().isEmpty());
+    lockstep.addInput("guest", 3, inputs("g3"));
+    const QList<TickBatch> batches = lockstep.advance();
+    QCOMPARE(batches.size(), 1);
+    QCOMPARE(batches.first().tick, quint32(2));
+    QCOMPARE(batches.first().predicted, QStringList() << "third");
+}
+
+void TestLockstep::checksums()
+{
+    LockstepCoordinator lockstep;
+    lockstep.addPlayer("host");
+    lockstep.addPlayer("guest");
+    lockstep.addPlayer("third");
+    lockstep.addInput("host", 1, inputs("h"));
+    lockstep.addInput("guest", 1, inputs("g"));
+    lockstep.addInput("third", 1, inputs("t"));
+    QCOMPARE(lockstep.advance().size(), 1);
+
+    // reports before the host's are held until the reference is known
+    QVERIFY(lockstep.addChecksum("guest", 1, 0xbad).isEmpty());
+    QCOMPARE(lockstep.addChecksum("host", 1, 0x600d), QStringList() << "guest");
+    QVERIFY(lockstep.addChecksum("third", 1, 0x600d).isEmpty());
+    // ticks that have not been released yet are ignored
+    QVERIFY(lockstep.addChecksum("guest", 5, 0xbad).isEmpty());
+}
+
+void TestLockstep::inputRoundTrip()
+{
+    QList<QByteArray> sent;
+    sent << "fire" << QByteArray() << QByteArray(1000, 'm');
+    QMap<quint32, quint32> sums;
+    sums.insert(3, 0xdeadbeef);
+    sums.insert(4, 7);
+
+    quint32 tick = 0;
+    QList<QByteArray> received;
+    QMap<quint32, quint32> receivedSums;
+    QVERIFY(LockstepCoordinator::decodeInput(LockstepCoordinator::encodeInput(17, sent, sums),
+                                             &tick, &received, &receivedSums));
+    QCOMPARE(tick, quint32(17));
+    QCOMPARE(received, sent);
+    QCOMPARE(receivedSums, sums);
+    QVERIFY(!LockstepCoordinator::decodeInput(QByteArray("\x00\x00", 2), &tick, &received, &receivedSums));
+}
+
+void TestLockstep::batchRoundTrip()
+{
+    TickBatch batch;
+    batch.tick = 42;
+    batch.players << "a" << "b";
+    batch.inputs << inputs("1") << QList<QByteArray>();
+    batch.predicted << "b";
+
+    TickBatch received;
+    QVERIFY(LockstepCoordinator::decodeBatch(LockstepCoordinator::encodeBatch(batch), &received));
+    QCOMPARE(received.tick, batch.tick);
+    QCOMPARE(received.players, batch.players);
+    QCOMPARE(received.inputs, batch.inputs);
+    QCOMPARE(received.predicted, batch.predicted);
+}
+
+QTEST_MAIN(TestLockstep)
+
+#include "tst_lockstep.moc"
@@ -0,0 +1,4 @@
+TARGET = tst_payloadcompressor
+include(../tests.pri)
+
+SOURCES += tst_payloadcompressor.cpp
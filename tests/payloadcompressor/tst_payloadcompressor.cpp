@@ -0,0 +1,158 @@
+#include <QtTest/QtTest>
+#include "payloadcompressor.h"
+#include "protocol.h"
+
+class TestPayloadCompressor : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void roundTrip_data();
+    void roundTrip();
+    void incompressible();
+    void otherDictionary();
+    void wrongDeclaredSize();
+    void oversizeDeclaredSize();
+    void inflatedBeyondData();
+    void corrupted();
+    void statistics();
+};
+
+static QByteArray text(int size)
+{
+    QByteArray data;
+    while (data.size() < size) {
+        data.append("{\"player\":\"someone\",\"x\":12,\"y\":34,\"message\":\"hello there\"}");
+    }
+    return data.left(size);
+}
+
+// the size varint followed by a zlib stream of data without a dictionary
+static QByteArray deflated(quint32 declaredSize, const QByteArray& data)
+{
+    QByteArray out;
+    Protocol::writeVarint(&out, declaredSize);
+    return out + qCompress(data).mid(4);
+}
+
+void TestPayloadCompressor::roundTrip_data()
+{
+    QTest::addColumn<QByteArray>("payload");
+    QTest::newRow("short") << text(200);
+    QTest::newRow("medium") << text(4000);
+    QTest::newRow("first buffer") << text(64 * 1024);
+    QTest::newRow("grown buffer") << text(64 * 1024 + 1);
+    QTest::newRow("large") << text(1024 * 1024);
+}
+
+void TestPayloadCompressor::roundTrip()
+{
+    QFETCH(QByteArray, payload);
+    PayloadCompressor sender;
+    PayloadCompressor receiver;
+    // one compressor per connection sees payload after payload
+    for (int i = 0; i < 3; ++i) {
+        QByteArray compressed;
+        QVERIFY(sender.compress(payload, &compressed));
+        QVERIFY(compressed.size() < payload.size());
+        QByteArray decompressed;
+        QVERIFY(receiver.decompress(compressed, &decompressed));
+        QCOMPARE(decompressed, payload);
+    }
+}
+
+void TestPayloadCompressor::incompressible()
+{
+    QByteArray noise;
+    qsrand(1);
+    for (int i = 0; i < 256; ++i) {
+        noise.append(char(qrand()));
+    }
+    PayloadCompressor compressor;
+    QByteArray compressed;
+    QVERIFY(!compressor.compress(noise, &compressed));
+}
+
+void TestPayloadCompressor::otherDictionary()
+{
+    PayloadCompressor sender;
+    PayloadCompressor receiver;
+    receiver.setDictionary("a dictionary the sender does not know about");
+    QByteArray compressed;
+    QVERIFY(sender.compress(text(500), &compressed));
+    QByteArray decompressed;
+    QVERIFY(!receiver.decompress(compressed, &decompressed));
+}
+
+void TestPayloadCompressor::wrongDeclaredSize()
+{
+    PayloadCompressor sender;
+    PayloadCompressor receiver;
+    QByteArray compressed;
+    QVERIFY(sender.compress(text(500), &compressed));
+
+    // same deflate stream, the size in front says one byte more or less
+    quint32 size = 0;
+    const int header = Protocol::readVarint(compressed.constData(), compressed.size(), &size);
+    QVERIFY(header > 0);
+    QByteArray decompressed;
+    QByteArray larger;
+    Protocol::writeVarint(&larger, size + 1);
+    QVERIFY(!receiver.decompress(larger + compressed.mid(header), &decompressed));
+    QByteArray smaller;
+    Protocol::writeVarint(&smaller, size - 1);
+    QVERIFY(!receiver.decompress(smaller + compressed.mid(header), &decompressed));
+    QVERIFY(receiver.decompress(compressed, &decompressed));
+}
+
+void TestPayloadCompressor::oversizeDeclaredSize()
+{
+    PayloadCompressor receiver;
+    QByteArray decompressed;
+    QVERIFY(!receiver.decompress(deflated(Protocol::MaxTransferSize + 1, "abc"), &decompressed));
+}
+
+void TestPayloadCompressor::inflatedBeyondData()
+{
+    // a few bytes claiming the largest size are refused once the stream
+    // ends, the claimed size never has to be allocated
+    PayloadCompressor receiver;
+    QByteArray decompressed;
+    QVERIFY(!receiver.decompress(deflated(Protocol::MaxTransferSize, "abc"), &decompressed));
+    QVERIFY(receiver.decompress(deflated(3, "abc"), &decompressed));
+    QCOMPARE(decompressed, QByteArray("abc"));
+}
+
+void TestPayloadCompressor::corrupted()
+{
+    PayloadCompressor sender;
+    PayloadCompressor receiver;
+    QByteArray compressed;
+    QVERIFY(sender.compress(text(2000), &compressed));
+    QByteArray decompressed;
+    QVERIFY(!receiver.decompress(compressed.left(compressed.size() / 2), &decompressed));
+    QVERIFY(!receiver.decompress(QByteArray(), &decompressed));
+    compressed[compressed.size() / 2] = ~compressed.at(compressed.size() / 2);
+    QVERIFY(!receiver.decompress(compressed, &decompressed));
+}
+
+void TestPayloadCompressor::statistics()
+{
+    PayloadCompressor sender;
+    PayloadCompressor receiver;
+    QByteArray compressed;
+    QByteArray decompressed;
+    QVERIFY(sender.compress(text(1000), &compressed));
+    QVERIFY(receiver.decompress(compressed, &decompressed));
+
+    const QVariantMap sent = sender.statistics();
+    QCOMPARE(sent.value("rawBytesSent").toLongLong(), qint64(1000));
+    QCOMPARE(sent.value("compressedBytesSent").toLongLong(), qint64(compressed.size()));
+    QVERIFY(sent.value("sendRatio").toDouble() < 1.0);
+    const QVariantMap received = receiver.statistics();
+    QCOMPARE(received.value("rawBytesReceived").toLongLong(), qint64(1000));
+}
+
+QTEST_MAIN(TestPayloadCompressor)
+
+#include "tst_payloadcompressor.moc"
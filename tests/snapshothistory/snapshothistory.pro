@@ -0,0 +1,4 @@
+TARGET = tst_snapshothistory
+include(../tests.pri)
+
+SOURCES += tst_snapshothistory.cpp
@@ -0,0 +1,195 @@
+#include <QtTest/QtTest>
+#include "snapshothistory.h"
+
+class TestSnapshotHistory : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void fullSnapshot();
+    void delta();
+    void unchangedEntriesStayOut();
+    void removedEntry();
+    void replacedEntry();
+    void unknownBase();
+    void historyWindow();
+};
+
+static StateEntry entry(const QVariantMap& fields)
+{
+    StateEntry result;
+    result.setFields(fields);
+    return result;
+}
+
+static QVariantMap fields(const QString& name, const QVariant& value)
+{
+    QVariantMap map;
+    map.insert(name, value);
+    return map;
+}
+
+// entries by key as plain maps, field order does not matter to the application
+static QVariantMap flatten(const StateTable& state)
+{
+    QVariantMap map;
+    StateTable::const_iterator it = state.constBegin();
+    for (; it != state.constEnd(); ++it) {
+        map.insert(it.key(), it->toMap());
+    }
+    return map;
+}
+
+// the server publishes, the client applies whatever the server encoded
+// against the client's latest snapshot
+static bool replicate(SnapshotHistory* server, SnapshotHistory* client, quint32 id,
+                      const StateTable& state, StateTable* received)
+{
+    server->add(id, state);
+    quint32 appliedId = 0;
+    if (!client->apply(server->encode(id, client->latestId()), &appliedId, received))
+        return false;
+    return appliedId == id;
+}
+
+void TestSnapshotHistory::fullSnapshot()
+{
+    StateTable state;
+    QVariantMap ship;
+    ship.insert("x", 10);
+    ship.insert("y", 20);
+    ship.insert("name", "enterprise");
+    state.insert("ship", entry(ship));
+    state.insert("score", entry(fields("points", 0)));
+
+    SnapshotHistory server;
+    SnapshotHistory client;
+    StateTable received;
+    QVERIFY(replicate(&server, &client, 1, state, &received));
+    QCOMPARE(flatten(received), flatten(state));
+    QCOMPARE(client.latestId(), quint32(1));
+}
+
+void TestSnapshotHistory::delta()
+{
+    SnapshotHistory server;
+    SnapshotHistory client;
+    StateTable received;
+
+    StateTable state;
+    QVariantMap ship;
+    ship.insert("x", 10);
+    ship.insert("y", 20);
+    state.insert("ship", entry(ship));
+    QVERIFY(replicate(&server, &client, 1, state, &received));
+
+    // a changed field and a new one
+    state["ship"].setFields(fields("x", 11));
+    state["ship"].setFields(fields("shield", true));
+    QVERIFY(replicate(&server, &client, 2, state, &received));
+    QCOMPARE(flatten(received), flatten(state));
+    QCOMPARE(received.value("ship").toMap().value("y").toInt(), 20);
+}
+
+void TestSnapshotHistory::unchangedEntriesStayOut()
+{
+    SnapshotHistory server;
+    StateTable state;
+    for (int i = 0; i < 50; ++i) {
+        state.insert(QString("entry%1").arg(i), entry(fields("value", QString(100, 'v'))));
+    }
+    server.add(1, state);
+    state["entry7"].setFields(fields("value", "changed"));
+    server.add(2, state);
+
+    const QByteArray full = server.encode(2, SnapshotHistory::NoSnapshot);
+    const QByteArray delta = server.encode(2, 1);
+    QVERIFY(delta.size() * 20 < full.size());
+}
+
+void TestSnapshotHistory::removedEntry()
+{
+    SnapshotHistory server;
+    SnapshotHistory client;
+    StateTable received;
+
+    StateTable state;
+    state.insert("a", entry(fields("v", 1)));
+    state.insert("b", entry(fields("v", 2)));
+    QVERIFY(replicate(&server, &client, 1, state, &received));
+
+    state.remove("a");
+    QVERIFY(replicate(&server, &client, 2, state, &received));
+    QVERIFY(!received.contains("a"));
+    QCOMPARE(flatten(received), flatten(state));
+}
+
+void TestSnapshotHistory::replacedEntry()
+{
+    SnapshotHistory server;
+    SnapshotHistory client;
+    StateTable received;
+
+    StateTable state;
+    QVariantMap ship;
+    ship.insert("x", 1);
+    ship.insert("y", 2);
+    state.insert("ship", entry(ship));
+    QVERIFY(replicate(&server, &client, 1, state, &received));
+
+    // set again with fewer fields, then with a field in front of the old one
+    state.remove("ship");
+    state.insert("ship", entry(fields("y", 3)));
+    QVERIFY(replicate(&server, &client, 2, state, &received));
+    QCOMPARE(flatten(received), flatten(state));
+
+    QVariantMap other;
+    other.insert("a", 4);
+    other.insert("y", 3);
+    state.insert("ship", entry(other));
+    QVERIFY(replicate(&server, &client, 3, state, &received));
+    QCOMPARE(flatten(received), flatten(state));
+    QVERIFY(!received.value("ship").toMap().contains("x"));
+}
+
+void TestSnapshotHistory::unknownBase()
+{
+    SnapshotHistory server;
+    StateTable state;
+    state.insert("a", entry(fields("v", 1)));
+    server.add(1, state);
+    state["a"].setFields(fields("v", 2));
+    server.add(2, state);
+
+    // the client never got snapshot 1
+    SnapshotHistory client;
+    quint32 id = 0;
+    StateTable received;
+    QVERIFY(!client.apply(server.encode(2, 1), &id, &received));
+    QVERIFY(client.apply(server.encode(2, SnapshotHistory::NoSnapshot), &id, &received));
+    QCOMPARE(id, quint32(2));
+    QCOMPARE(flatten(received), flatten(state));
+}
+
+void TestSnapshotHistory::historyWindow()
+{
+    SnapshotHistory history;
+    StateTable state;
+    for (quint32 id = 1; id <= 100; ++id) {
+        state.insert("tick", entry(fields("id", id)));
+        history.add(id, state);
+    }
+    StateTable found;
+    QVERIFY(history.find(100, &found));
+    QVERIFY(!history.find(1, &found));
+    QVERIFY(!history.find(SnapshotHistory::NoSnapshot, &found));
+    // an unknown base falls back to a full snapshot
+    SnapshotHistory client;
+    quint32 id = 0;
+    QVERIFY(client.apply(history.encode(100, 1), &id, &found));
+    QCOMPARE(found.value("tick").toMap().value("id").toUInt(), 100u);
+}
+
+QTEST_MAIN(TestSnapshotHistory)
+
+#include "tst_snapshothistory.moc"
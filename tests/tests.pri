@@ -0,0 +1,9 @@
+TEMPLATE = app
+
+QT += network testlib
+QT -= gui
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../../src
+LIBS += -L$$OUT_PWD/../.. -lBattleQt -lz
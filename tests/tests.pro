@@ -0,0 +1,11 @@
+# Unit tests of the protocol building blocks, they work on buffers, only the
+# framewriter test talks over a loopback socket. Build BattleQt.pro first, then
+# run make check here.
+
+TEMPLATE = subdirs
+SUBDIRS += framedecoder \
+    fragmentassembler \
+    snapshothistory \
+    lockstep \
+    payloadcompressor \
+    framewriter
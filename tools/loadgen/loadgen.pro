@@ -0,0 +1,20 @@
+# Simulates many players against one server from a single process.
+# Build BattleQt.pro first, then run for example
+#   ./loadgen --host 192.168.1.2 --port 4000 --clients 300 --rate 20
+# One line per report interval goes to stdout, columns are named in the
+# first line.
+
+TEMPLATE = app
+TARGET = loadgen
+
+QT += network
+QT -= gui
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../../src
+LIBS += -L$$OUT_PWD/../.. -lBattleQt -lz
+
+HEADERS += loadgenerator.h
+SOURCES += main.cpp \
+    loadgenerator.cpp
@@ -0,0 +1,233 @@
+#include "loadgenerator.h"
+#include "client.h"
+#include <QTextStream>
+#include <QStringList>
+#include <QtAlgorithms>
+
+// sends are spread over this many timer ticks per second
+static const int SendTickMsecs = 10;
+
+static qint64 percentile(QList<qint64> sorted, int percent)
+{
+    if (sorted.isEmpty())
+        return -1;
+    return sorted.at((sorted.size() - 1) * percent / 100);
+}
+
+static QString msecs(qint64 usecs)
+{
+    return usecs < 0 ? QString("-") : QString::number(usecs / 1000.0, 'f', 2);
+}
+
+LoadGenerator::LoadGenerator(const LoadOptions& options, QTextStream* out, QObject *parent) :
+    QObject(parent),
+    m_options(options),
+    m_out(out),
+    m_lastSend(0),
+    m_lastReport(0),
+    m_sendBudget(0),
+    m_nextSender(0),
+    m_message(qMax(1, options.messageSize), QChar('x')),
+    m_data(qMax(1, options.dataSize), 'x'),
+    m_stopping(false)
+{
+    connect(&m_connectTimer, SIGNAL(timeout()), this, SLOT(connectMore()));
+    connect(&m_sendTimer, SIGNAL(timeout()), this, SLOT(send()));
+    connect(&m_pingTimer, SIGNAL(timeout()), this, SLOT(ping()));
+    connect(&m_reportTimer, SIGNAL(timeout()), this, SLOT(report()));
+}
+
+LoadGenerator::~LoadGenerator()
+{
+    foreach (const Player& player, m_players) {
+        delete player.client;
+    }
+}
+
+void LoadGenerator::start()
+{
+    for (int i = 0; i < m_options.clients; ++i) {
+        m_players.append(Player());
+    }
+    m_clock.start();
+    // ramp in steps of a tenth of a second
+    m_connectTimer.start(100);
+    connectMore();
+    m_sendTimer.start(SendTickMsecs);
+    if (m_options.pingIntervalMsecs > 0)
+        m_pingTimer.start(m_options.pingIntervalMsecs);
+    m_reportTimer.start(m_options.reportIntervalMsecs);
+    if (m_options.durationSecs > 0)
+        QTimer::singleShot(m_options.durationSecs * 1000, this, SLOT(stop()));
+
+    *m_out << "# time_s clients joined join_p50_ms join_p99_ms rtt_p50_ms rtt_p90_ms rtt_p99_ms "
+              "messages_s data_s bytes_s join_failures disconnects" << endl;
+}
+
+void LoadGenerator::connectMore()
+{
+    const int started = m_indexes.size();
+    const int target = qMin(m_options.clients,
+                            int(qMax(Q_INT64_C(1), m_clock.elapsed() * m_options.rampPerSecond / 1000)));
+    for (int i = started; i < target; ++i) {
+        Player& player = m_players[i];
+        player.client = new Client(this);
+        player.client->setPlayerName(QString("loadgen-%1").arg(i));
+        player.client->setPassword(m_options.password);
+        connect(player.client, SIGNAL(joinSuccess(QString)), this, SLOT(onJoinSuccess()));
+        connect(player.client, SIGNAL(joinError(QString)), this, SLOT(onJoinError(QString)));
+        connect(player.client, SIGNAL(partSuccess()), this, SLOT(onPartSuccess()));
+        connect(player.client, SIGNAL(pong(int)), this, SLOT(onPong()));
+        m_indexes.insert(player.client, i);
+        player.joinTimer.start();
+        player.client->join(m_options.host, QString::number(m_options.port));
+    }
+    if (target >= m_options.clients)
+        m_connectTimer.stop();
+}
+
+LoadGenerator::Player* LoadGenerator::playerOf(QObject* sender)
+{
+    QHash<QObject*, int>::const_iterator it = m_indexes.constFind(sender);
+    return it == m_indexes.constEnd() ? 0 : &m_players[it.value()];
+}
+
+void LoadGenerator::onJoinSuccess()
+{
+    Player* player = playerOf(sender());
+    if (!player || player->joined)
+        return;
+    player->joined = true;
+    const qint64 usecs = player->joinTimer.nsecsElapsed() / 1000;
+    m_interval.joinUsecs.append(usecs);
+    m_total.joinUsecs.append(usecs);
+    m_joined.append(m_indexes.value(sender()));
+}
+
+void LoadGenerator::onJoinError(QString error)
+{
+    Q_UNUSED(error);
+    Player* player = playerOf(sender());
+    if (!player)
+        return;
+    if (player->joined) {
+        player->joined = false;
+        m_joined.removeOne(m_indexes.value(sender()));
+        ++m_interval.disconnects;
+        ++m_total.disconnects;
+    } else {
+        ++m_interval.joinFailures;
+        ++m_total.joinFailures;
+    }
+}
+
+void LoadGenerator::onPartSuccess()
+{
+    Player* player = playerOf(sender());
+    if (!player || !player->joined || m_stopping)
+        return;
+    player->joined = false;
+    m_joined.removeOne(m_indexes.value(sender()));
+    ++m_interval.disconnects;
+    ++m_total.disconnects;
+}
+
+void LoadGenerator::send()
+{
+    // the target rate is shared out round robin, fractions carry over
+    const qint64 now = m_clock.nsecsElapsed();
+    if (m_joined.isEmpty()) {
+        m_lastSend = now;
+        return;
+    }
+    m_sendBudget += double(now - m_lastSend) / 1e9 * m_options.messagesPerSecond * m_joined.size();
+    m_lastSend = now;
+    // a stalled loop does not turn into a burst
+    m_sendBudget = qMin(m_sendBudget, double(m_joined.size()) * qMax(1, m_options.messagesPerSecond));
+
+    while (m_sendBudget >= 1) {
+        m_sendBudget -= 1;
+        m_nextSender = (m_nextSender + 1) % m_joined.size();
+        Client* client = m_players.at(m_joined.at(m_nextSender)).client;
+        if (m_options.dataRatio > 0 && qrand() < m_options.dataRatio * RAND_MAX) {
+            client->sendData(m_data);
+            ++m_interval.data;
+            ++m_total.data;
+            m_interval.bytes += m_data.size();
+            m_total.bytes += m_data.size();
+        } else {
+            client->sendMessage(m_message);
+            ++m_interval.messages;
+            ++m_total.messages;
+            m_interval.bytes += m_message.size();
+            m_total.bytes += m_message.size();
+        }
+    }
+}
+
+void LoadGenerator::ping()
+{
+    // one ping in flight per client, a lost one is replaced next round
+    const qint64 now = m_clock.nsecsElapsed();
+    foreach (int index, m_joined) {
+        Player& player = m_players[index];
+        player.pingSent = now;
+        player.client->ping();
+    }
+}
+
+void LoadGenerator::onPong()
+{
+    Player* player = playerOf(sender());
+    if (!player || player->pingSent < 0)
+        return;
+    const qint64 usecs = (m_clock.nsecsElapsed() - player->pingSent) / 1000;
+    player->pingSent = -1;
+    m_interval.rttUsecs.append(usecs);
+    m_total.rttUsecs.append(usecs);
+}
+
+void LoadGenerator::printInterval(const char* label, const Interval& interval, qint64 elapsedMsecs)
+{
+    QList<qint64> joins = interval.joinUsecs;
+    QList<qint64> rtts = interval.rttUsecs;
+    qSort(joins);
+    qSort(rtts);
+    const double secs = qMax(Q_INT64_C(1), elapsedMsecs) / 1000.0;
+    QStringList fields;
+    fields << label
+           << QString::number(m_indexes.size())
+           << QString::number(m_joined.size())
+           << msecs(percentile(joins, 50)) << msecs(percentile(joins, 99))
+           << msecs(percentile(rtts, 50)) << msecs(percentile(rtts, 90)) << msecs(percentile(rtts, 99))
+           << QString::number(interval.messages / secs, 'f', 1)
+           << QString::number(interval.data / secs, 'f', 1)
+           << QString::number(interval.bytes / secs, 'f', 0)
+           << QString::number(interval.joinFailures)
+           << QString::number(interval.disconnects);
+    *m_out << fields.join(" ") << endl;
+}
+
+void LoadGenerator::report()
+{
+    const qint64 now = m_clock.elapsed();
+    printInterval(qPrintable(QString::number(now / 1000.0, 'f', 1)), m_interval, now - m_lastReport);
+    m_interval = Interval();
+    m_lastReport = now;
+}
+
+void LoadGenerator::stop()
+{
+    m_stopping = true;
+    m_connectTimer.stop();
+    m_sendTimer.stop();
+    m_pingTimer.stop();
+    m_reportTimer.stop();
+    report();
+    printInterval("total", m_total, m_clock.elapsed());
+    foreach (const Player& player, m_players) {
+        if (player.client)
+            player.client->close();
+    }
+    emit finished(m_total.joinFailures + m_total.disconnects);
+}
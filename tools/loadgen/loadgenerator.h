@@ -0,0 +1,118 @@
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QTimer>
+
+class QTextStream;
+class Client;
+
+struct LoadOptions
+{
+    LoadOptions() :
+        port(0),
+        clients(100),
+        rampPerSecond(50),
+        messagesPerSecond(10),
+        messageSize(32),
+        dataRatio(0),
+        dataSize(4096),
+        pingIntervalMsecs(1000),
+        reportIntervalMsecs(5000),
+        durationSecs(60)
+    {}
+
+    QString host;
+    quint16 port;
+    QString password;
+    int clients;
+    // new connections started per second
+    int rampPerSecond;
+    // per joined client
+    int messagesPerSecond;
+    int messageSize;
+    // share of sends that go out as data instead of text, 0 to 1
+    double dataRatio;
+    int dataSize;
+    int pingIntervalMsecs;
+    int reportIntervalMsecs;
+    int durationSecs;
+};
+
+// opens many Client connections to one server from a single event loop and
+// reports join latency, round trip percentiles, throughput and failures
+class LoadGenerator : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LoadGenerator(const LoadOptions& options, QTextStream* out, QObject *parent = 0);
+    ~LoadGenerator();
+
+public slots:
+    void start();
+
+signals:
+    void finished(int failures);
+
+private slots:
+    void connectMore();
+    void send();
+    void ping();
+    void report();
+    void stop();
+    void onJoinSuccess();
+    void onJoinError(QString error);
+    void onPartSuccess();
+    void onPong();
+
+private:
+    struct Player
+    {
+        Player() : client(0), joined(false), pingSent(-1) {}
+        Client* client;
+        QElapsedTimer joinTimer;
+        bool joined;
+        // elapsed time of the ping in flight, -1 for none
+        qint64 pingSent;
+    };
+
+    struct Interval
+    {
+        Interval() : messages(0), data(0), bytes(0), joinFailures(0), disconnects(0) {}
+        QList<qint64> joinUsecs;
+        QList<qint64> rttUsecs;
+        qint64 messages;
+        qint64 data;
+        qint64 bytes;
+        int joinFailures;
+        int disconnects;
+    };
+
+    void printInterval(const char* label, const Interval& interval, qint64 msecs);
+    Player* playerOf(QObject* sender);
+
+    LoadOptions m_options;
+    QTextStream* m_out;
+    QList<Player> m_players;
+    QHash<QObject*, int> m_indexes;
+    QList<int> m_joined;
+    QTimer m_connectTimer;
+    QTimer m_sendTimer;
+    QTimer m_pingTimer;
+    QTimer m_reportTimer;
+    QElapsedTimer m_clock;
+    qint64 m_lastSend;
+    qint64 m_lastReport;
+    double m_sendBudget;
+    int m_nextSender;
+    QString m_message;
+    QByteArray m_data;
+    Interval m_interval;
+    Interval m_total;
+    bool m_stopping;
+};
+
+#endif // LOADGENERATOR_H
@@ -0,0 +1,109 @@
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTextStream>
+#include "loadgenerator.h"
+
+static QTextStream out(stdout);
+static QTextStream err(stderr);
+static int exitCode = 0;
+
+// every simulated client logs its handshake, only warnings get through
+static void quietMessages(QtMsgType type, const char* message)
+{
+    if (type != QtDebugMsg)
+        err << message << endl;
+}
+
+static void usage()
+{
+    err << "usage: loadgen --host <ip> --port <port> [options]\n"
+           "  --password <text>      server password\n"
+           "  --clients <n>          simulated players, default 100\n"
+           "  --ramp <n>             connections started per second, default 50\n"
+           "  --rate <n>             messages per second per player, default 10\n"
+           "  --size <bytes>         text message size, default 32\n"
+           "  --data-ratio <0..1>    share of sends that are data blocks, default 0\n"
+           "  --data-size <bytes>    data block size, default 4096\n"
+           "  --ping <msecs>         ping interval, 0 for none, default 1000\n"
+           "  --report <msecs>       report interval, default 5000\n"
+           "  --duration <secs>      run time, 0 until interrupted, default 60\n"
+           "  --verbose              keep the library's debug output\n" << endl;
+}
+
+class Finisher : public QObject
+{
+    Q_OBJECT
+public slots:
+    void finish(int failures)
+    {
+        exitCode = failures ? 1 : 0;
+        // let the clients say goodbye before the loop ends
+        QTimer::singleShot(500, qApp, SLOT(quit()));
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    LoadOptions options;
+    bool verbose = false;
+
+    QStringList args = app.arguments();
+    args.removeFirst();
+    while (!args.isEmpty()) {
+        const QString name = args.takeFirst();
+        if (name == "--verbose") {
+            verbose = true;
+            continue;
+        }
+        if (args.isEmpty()) {
+            usage();
+            return 2;
+        }
+        const QString value = args.takeFirst();
+        if (name == "--host") {
+            options.host = value;
+        } else if (name == "--port") {
+            options.port = value.toUShort();
+        } else if (name == "--password") {
+            options.password = value;
+        } else if (name == "--clients") {
+            options.clients = value.toInt();
+        } else if (name == "--ramp") {
+            options.rampPerSecond = value.toInt();
+        } else if (name == "--rate") {
+            options.messagesPerSecond = value.toInt();
+        } else if (name == "--size") {
+            options.messageSize = value.toInt();
+        } else if (name == "--data-ratio") {
+            options.dataRatio = value.toDouble();
+        } else if (name == "--data-size") {
+            options.dataSize = value.toInt();
+        } else if (name == "--ping") {
+            options.pingIntervalMsecs = value.toInt();
+        } else if (name == "--report") {
+            options.reportIntervalMsecs = value.toInt();
+        } else if (name == "--duration") {
+            options.durationSecs = value.toInt();
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (options.host.isEmpty() || !options.port || options.clients <= 0
+            || options.rampPerSecond <= 0 || options.reportIntervalMsecs <= 0) {
+        usage();
+        return 2;
+    }
+    if (!verbose)
+        qInstallMsgHandler(quietMessages);
+
+    LoadGenerator generator(options, &out);
+    Finisher finisher;
+    QObject::connect(&generator, SIGNAL(finished(int)), &finisher, SLOT(finish(int)));
+    generator.start();
+    app.exec();
+    return exitCode;
+}
+
+#include "main.moc"